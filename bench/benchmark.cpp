@@ -0,0 +1,546 @@
+// Benchmarks every layer of the cipher, from field arithmetic up to whole files, and reports MB/s and cycles per byte
+// Build: g++ -std=c++20 -O2 -pthread -o benchmark bench/benchmark.cpp
+// Usage: benchmark [--filter text] [--min-time seconds] [--json path] [--large]
+//
+// Tiers, selectable with --filter on the name prefix:
+//   micro/   GF256 multiply and inverse, S-box kernel, subWord, matrix multiply, shiftRows, mixColumns, key schedule, reference block encrypt
+//   engine/  RoundEngine batches on each backend the CPU supports (ECB, so only the backend is measured), under AES-128 and AES-256 keys
+//   cbc/     BlockString construction and CBC at 1 KB and 1 MB, plus 1 GB with --large, and 1024 short messages one by one or multi-buffer
+//   stream/  CTR and GCM streams and threaded CBC decryption at 1 MB
+//   kdf/     SHA-256 compression, PBKDF2 iterations and scrypt at the default cost
+//   rng/     IV draws from the thread's generator against a fresh mt19937 per IV and a getrandom call, and bulk output at 1 MB
+//   file/    processFile round trips on a temporary file through each I/O method (stream, mmap, io_uring and pread threads, direct or cached)
+//            in the stream format and the default chunked format, and chunked under AES-256 keys
+// Cycles are TSC ticks, which run at the base clock rather than the current core clock.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <random>
+
+#include "../src/gf256.hpp"
+#include "../src/vector.hpp"
+#include "../src/matrix.hpp"
+#include "../src/block.hpp"
+#include "../src/block_string.hpp"
+#include "../src/key_schedule.hpp"
+#include "../src/round_engine.hpp"
+#include "../src/cbc_stream.hpp"
+#include "../src/multi_buffer.hpp"
+#include "../src/ctr_stream.hpp"
+#include "../src/gcm_stream.hpp"
+#include "../src/cpu_features.hpp"
+#include "../src/cipher_parameters.hpp"
+#include "../src/cipher_variant.hpp"
+#include "../src/file_crypt.hpp"
+#include "../src/sha256.hpp"
+#include "../src/kdf.hpp"
+#include "../src/password_keys.hpp"
+#include "../src/secure_random.hpp"
+#include "../src/thread_pool.hpp"
+#include "../src/stats.hpp"
+
+template <typename T>
+inline void doNotOptimize(T& value) { // Makes the compiler assume value is read and changed, so the work producing it can't be dropped
+#if defined(__GNUC__)
+    asm volatile("" : "+m"(value) : : "memory");
+#else
+    volatile char sink = *reinterpret_cast<volatile char*>(&value);
+    (void)sink;
+#endif
+}
+
+struct BenchmarkResult {
+    std::string name;
+    double bytesPerIteration;
+    uint64_t iterations;
+    double seconds;
+    uint64_t cycles;
+
+    double nanosecondsPerIteration() const {
+        return seconds * 1e9 / iterations;
+    }
+
+    double megabytesPerSecond() const {
+        return bytesPerIteration * iterations / seconds / 1e6;
+    }
+
+    double cyclesPerByte() const {
+        return static_cast<double>(cycles) / (bytesPerIteration * iterations);
+    }
+};
+
+class BenchmarkRunner {
+    std::string filter;
+    double minTime;
+    std::vector<BenchmarkResult> results;
+
+public:
+    BenchmarkRunner(std::string filter, double minTime) : filter(filter), minTime(minTime) {}
+
+    bool selected(const std::string& name) const {
+        return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    bool tierSelected(const std::string& prefix) const { // Whether a filter on the name prefix can pick anything under prefix, so a tier's setup is skipped only when it would be wasted
+        return filter.empty() || filter.starts_with(prefix) || prefix.starts_with(filter);
+    }
+
+    template <typename Body>
+    void run(const std::string& name, double bytesPerIteration, Body&& body) { // Doubles the iteration count, or jumps to the estimate, until one timed run lasts minTime
+        if (!selected(name)) return;
+
+        uint64_t iterations = 1;
+        double seconds = 0;
+        uint64_t cycles = 0;
+
+        while (true) {
+            auto start = std::chrono::steady_clock::now();
+            uint64_t startCycles = readCycles();
+
+            for (uint64_t i = 0; i < iterations; i++) {
+                body();
+            }
+
+            cycles = readCycles() - startCycles;
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (seconds >= minTime) break;
+
+            double estimate = seconds > 0 ? iterations * minTime / seconds * 1.2 : iterations * 10.0;
+            iterations = std::max(iterations * 2, static_cast<uint64_t>(std::min(estimate, 1e12)));
+        }
+
+        BenchmarkResult result{name, bytesPerIteration, iterations, seconds, cycles};
+        results.push_back(result);
+
+        std::cout << std::left << std::setw(36) << name << std::right << std::fixed
+                  << std::setw(14) << std::setprecision(1) << result.nanosecondsPerIteration() << " ns"
+                  << std::setw(12) << std::setprecision(1) << result.megabytesPerSecond() << " MB/s"
+                  << std::setw(10) << std::setprecision(2) << result.cyclesPerByte() << " c/B"
+                  << std::setw(12) << iterations << '\n';
+    }
+
+    void writeJson(std::ostream& stream) const { // Field names follow Google Benchmark's JSON so existing comparison tools can read it
+        const CpuFeatures& cpu = CpuFeatures::get();
+
+        stream << "{\n  \"context\": {\n"
+               << "    \"engine_backend\": \"" << backendName(roundEngine.resolve<cols>(EngineBackend::Auto)) << "\",\n"
+               << "    \"aes\": " << (cpu.hasAES() ? "true" : "false") << ",\n"
+               << "    \"avx2\": " << (cpu.hasAVX2() ? "true" : "false") << ",\n"
+               << "    \"ssse3\": " << (cpu.hasSSSE3() ? "true" : "false") << ",\n"
+               << "    \"pclmul\": " << (cpu.hasPCLMUL() ? "true" : "false") << ",\n"
+               << "    \"sha\": " << (cpu.hasSHA() ? "true" : "false") << ",\n"
+               << "    \"avx512\": " << (cpu.hasAVX512() ? "true" : "false") << ",\n"
+               << "    \"vaes\": " << (cpu.hasVAES() ? "true" : "false") << ",\n"
+               << "    \"threads\": " << ThreadPool::defaultThreadCount() << "\n"
+               << "  },\n  \"benchmarks\": [\n";
+
+        for (size_t i = 0; i < results.size(); i++) {
+            const BenchmarkResult& result = results[i];
+
+            stream << "    {\"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+                   << ", \"real_time\": " << result.nanosecondsPerIteration() << ", \"time_unit\": \"ns\""
+                   << ", \"bytes_per_second\": " << result.megabytesPerSecond() * 1e6
+                   << ", \"cycles_per_byte\": " << result.cyclesPerByte() << "}"
+                   << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+
+        stream << "  ]\n}\n";
+    }
+
+    static const char* backendName(EngineBackend backend) {
+        switch (backend) {
+            case EngineBackend::Table: return "table";
+            case EngineBackend::Bitsliced: return "bitsliced";
+            case EngineBackend::AesNi: return "aes-ni";
+            case EngineBackend::Vaes: return "vaes";
+            default: return "auto";
+        }
+    }
+};
+
+std::string makeText(size_t length) {
+    std::string text(length, '\0');
+
+    for (size_t i = 0; i < length; i++) {
+        text[i] = static_cast<char>(i * 2654435761u >> 13);
+    }
+
+    return text;
+}
+
+void benchmarkMicro(BenchmarkRunner& runner, const KeySchedule<cols, rows, rounds>& keySchedule) {
+    std::array<GF256, 256> values;
+
+    for (int i = 0; i < 256; i++) {
+        values[i] = static_cast<uint8_t>(i * 167 + 13);
+    }
+
+    runner.run("micro/gf256/multiply", 256, [&]() {
+        GF256 product = 1;
+
+        for (GF256 value : values) {
+            product = product * value + GF256(1);
+        }
+
+        doNotOptimize(product);
+    });
+
+    runner.run("micro/gf256/inverse", 256, [&]() {
+        GF256 sum = 0;
+
+        for (GF256 value : values) {
+            sum += (value + sum).inv();
+        }
+
+        doNotOptimize(sum);
+    });
+
+    std::vector<GF256> sboxBytes(4096);
+
+    for (size_t i = 0; i < sboxBytes.size(); i++) {
+        sboxBytes[i] = static_cast<uint8_t>(i * 31);
+    }
+
+    runner.run("micro/sbox/substitute/4KB", sboxBytes.size(), [&]() {
+        subBox.substitute<false>(sboxBytes.data(), sboxBytes.size());
+        doNotOptimize(sboxBytes[0]);
+    });
+
+    Vector<rows> word = keySchedule.getRoundKey(1)[0];
+
+    runner.run("micro/vector/subWord", rows, [&]() {
+        word.subWord(subBox);
+        doNotOptimize(word);
+    });
+
+    runner.run("micro/matrix/matMultiply", rows, [&]() {
+        word = word * mixColMatrix;
+        doNotOptimize(word);
+    });
+
+    Block<cols, rows> block = Block<cols, rows>::fromString(makeText(blockSize));
+
+    runner.run("micro/block/shiftRows", blockSize, [&]() {
+        block.shiftRows();
+        doNotOptimize(block);
+    });
+
+    runner.run("micro/block/mixColumns", blockSize, [&]() {
+        block.mixColumns(mixColMatrix);
+        doNotOptimize(block);
+    });
+
+    runner.run("micro/block/encrypt-reference", blockSize, [&]() {
+        block.encrypt(keySchedule, subBox, mixColMatrix);
+        doNotOptimize(block);
+    });
+
+    Block<keyWordCount, rows> key = Block<keyWordCount, rows>::fromString(makeText(keySize));
+
+    runner.run("micro/keyschedule/construct", keySize, [&]() {
+        KeySchedule<cols, rows, rounds> schedule(key, subBox, roundConstants);
+        doNotOptimize(schedule);
+    });
+
+    runner.run("micro/keyschedule/construct-inverse", keySize, [&]() {
+        KeySchedule<cols, rows, rounds> schedule(key, subBox, roundConstants, mixColMatrixInv);
+        doNotOptimize(schedule);
+    });
+
+    std::string serialized = KeySchedule<cols, rows, rounds>(key, subBox, roundConstants, mixColMatrixInv).serialize();
+
+    runner.run("micro/keyschedule/deserialize", keySize, [&]() { // What a cache backed by stored schedules pays instead of expanding
+        KeySchedule<cols, rows, rounds> schedule = KeySchedule<cols, rows, rounds>::deserialize(serialized);
+        doNotOptimize(schedule);
+    });
+}
+
+template <size_t keyRounds>
+void benchmarkEngine(BenchmarkRunner& runner, const KeySchedule<cols, rows, keyRounds>& keySchedule, const std::string& group) { // group names the key size, the default AES-128 entries keep their plain engine/ names
+    constexpr size_t blockCount = (1 << 20) / blockSize;
+    std::vector<Block<cols, rows>> blocks(blockCount, Block<cols, rows>::fromString(makeText(blockSize)));
+
+    for (EngineBackend backend : {EngineBackend::Table, EngineBackend::Bitsliced, EngineBackend::AesNi, EngineBackend::Vaes}) {
+        if (!roundEngine.supports<cols>(backend)) continue;
+
+        std::string prefix = group + BenchmarkRunner::backendName(backend);
+
+        runner.run(prefix + "/encrypt/1MB", blockCount * blockSize, [&]() {
+            roundEngine.encryptBlocks(blocks.data(), blockCount, keySchedule, backend);
+            doNotOptimize(blocks[0]);
+        });
+
+        runner.run(prefix + "/decrypt/1MB", blockCount * blockSize, [&]() {
+            roundEngine.decryptBlocks(blocks.data(), blockCount, keySchedule, backend);
+            doNotOptimize(blocks[0]);
+        });
+    }
+}
+
+void benchmarkCbc(BenchmarkRunner& runner, const KeySchedule<cols, rows, rounds>& keySchedule, bool large) {
+    Block<cols, rows> ivBlock = Block<cols, rows>::fromString(makeText(blockSize));
+
+    std::vector<std::pair<std::string, size_t>> sizes = {{"1KB", 1 << 10}, {"1MB", 1 << 20}};
+    if (large) sizes.push_back({"1GB", size_t(1) << 30});
+
+    for (const auto& [label, length] : sizes) {
+        if (!runner.tierSelected("cbc/")) continue;
+
+        std::string text = makeText(length);
+        BlockString<cols, rows> blockString(text, false); // Padded plaintext, encrypting or decrypting it repeatedly costs the same as real data
+
+        runner.run("cbc/construct/" + label, length, [&]() { // Pooled copy and padding, the buffer comes back from the pool after the first iteration
+            BlockString<cols, rows> copy(std::as_bytes(std::span(text)), false);
+        });
+
+        runner.run("cbc/encrypt/" + label, length, [&]() {
+            blockString.cbcEncrypt(keySchedule, roundEngine, ivBlock);
+        });
+
+        runner.run("cbc/decrypt/" + label, length, [&]() {
+            blockString.cbcDecrypt(keySchedule, roundEngine, ivBlock);
+        });
+    }
+
+    if (!runner.tierSelected("cbc/")) return;
+
+    std::vector<BlockString<cols, rows>> messages; // Many short messages of mixed lengths, as a server encrypting small requests sees them
+    std::vector<CbcJob<cols, rows, rounds>> jobs;
+    size_t totalLength = 0;
+
+    for (size_t m = 0; m < 1024; m++) {
+        messages.emplace_back(makeText(64 + m * 97 % 1984), false);
+        totalLength += messages.back().getBytes().size();
+    }
+
+    for (BlockString<cols, rows>& message : messages) {
+        jobs.push_back({&keySchedule, ivBlock, message.getBlocks()});
+    }
+
+    runner.run("cbc/many/serial", totalLength, [&]() {
+        for (BlockString<cols, rows>& message : messages) message.cbcEncrypt(keySchedule, roundEngine, ivBlock);
+    });
+
+    runner.run("cbc/many/multi-buffer", totalLength, [&]() {
+        cbcEncryptJobs(std::span(jobs), roundEngine);
+    });
+}
+
+void benchmarkStreams(BenchmarkRunner& runner, const KeySchedule<cols, rows, rounds>& keySchedule, ThreadPool& pool) {
+    constexpr size_t length = 1 << 20;
+
+    std::string input = makeText(length);
+    std::vector<char> output(length + blockSize);
+    Block<cols, rows> ivBlock = Block<cols, rows>::fromString(makeText(blockSize));
+
+    runner.run("stream/cbc/decrypt/1MB", length, [&]() {
+        CbcStream<cols, rows, rounds> stream(keySchedule, roundEngine, ivBlock, true);
+        stream.update(input.data(), length, output.data());
+    });
+
+    runner.run("stream/cbc/decrypt-threads/1MB", length, [&]() {
+        CbcStream<cols, rows, rounds> stream(keySchedule, roundEngine, ivBlock, true, &pool);
+        stream.update(input.data(), length, output.data());
+    });
+
+    runner.run("stream/ctr/1MB", length, [&]() {
+        CtrStream<cols, rows, rounds> stream(keySchedule, roundEngine, ivBlock);
+        stream.update(input.data(), length, output.data());
+    });
+
+    runner.run("stream/ctr-threads/1MB", length, [&]() {
+        CtrStream<cols, rows, rounds> stream(keySchedule, roundEngine, ivBlock, &pool);
+        stream.update(input.data(), length, output.data());
+    });
+
+    runner.run("stream/gcm/encrypt/1MB", length, [&]() {
+        GcmStream<cols, rows, rounds> stream(keySchedule, roundEngine, makeText(GcmStream<cols, rows, rounds>::ivLength), false);
+        stream.update(input.data(), length, output.data());
+        stream.finish(output.data());
+    });
+}
+
+void benchmarkKeyDerivation(BenchmarkRunner& runner) {
+    std::string message = makeText(1 << 16);
+
+    runner.run("kdf/sha256/64KB", message.size(), [&]() {
+        Sha256::Digest digest = Sha256::hash(message.data(), message.size());
+        doNotOptimize(digest);
+    });
+
+    KdfParameters pbkdf2;
+    pbkdf2.iterations = 100000;
+
+    runner.run("kdf/pbkdf2/100k-iterations", keySize, [&]() { // Each iteration is two compressions, so this is also the single chain SHA-256 latency
+        std::vector<uint8_t> key = Kdf::derive("benchmark password", pbkdf2, keySize);
+        doNotOptimize(key[0]);
+    });
+
+    KdfParameters scrypt;
+    scrypt.algorithm = KdfAlgorithm::Scrypt;
+
+    runner.run("kdf/scrypt/default", keySize, [&]() {
+        std::vector<uint8_t> key = Kdf::derive("benchmark password", scrypt, keySize);
+        doNotOptimize(key[0]);
+    });
+}
+
+void benchmarkRandom(BenchmarkRunner& runner) {
+    char iv[blockSize];
+    std::vector<char> bulk(1 << 20);
+
+    runner.run("rng/iv/16B", blockSize, [&]() {
+        SecureRandom::local().fill(iv, blockSize);
+        doNotOptimize(iv[0]);
+    });
+
+    runner.run("rng/iv-mt19937/16B", blockSize, [&]() { // How IVs were drawn before the generator, seeded from random_device every time
+        std::mt19937 gen(std::random_device{}());
+        std::uniform_int_distribution<> dist(0, 255);
+
+        for (size_t i = 0; i < blockSize; i++) iv[i] = static_cast<char>(dist(gen));
+
+        doNotOptimize(iv[0]);
+    });
+
+    runner.run("rng/getrandom/16B", blockSize, [&]() {
+        SecureRandom::systemRandom(iv, blockSize);
+        doNotOptimize(iv[0]);
+    });
+
+    runner.run("rng/fill/1MB", bulk.size(), [&]() {
+        SecureRandom::local().fill(bulk.data(), bulk.size());
+        doNotOptimize(bulk[0]);
+    });
+}
+
+void benchmarkFiles(BenchmarkRunner& runner, ThreadPool& pool, bool large) {
+    if (!runner.tierSelected("file/")) return;
+
+    KdfParameters rawKey; // Measures the file path only, the derivation has its own benchmarks
+    rawKey.algorithm = KdfAlgorithm::None;
+    PasswordKeys keys(makeText(keySize), rawKey);
+    PasswordKeys longKeys(makeText(CipherShape<8>::keySize), rawKey);
+
+    size_t length = large ? size_t(1) << 30 : size_t(64) << 20;
+    std::string label = large ? "1GB" : "64MB";
+
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "diy-encryptor-benchmark";
+    std::filesystem::create_directories(directory);
+
+    std::string filePath = (directory / "data").string();
+
+    {
+        std::ofstream file(filePath, std::ios::binary);
+        std::string chunk = makeText(1 << 20);
+
+        for (size_t written = 0; written < length; written += chunk.size()) {
+            file.write(chunk.data(), std::min(chunk.size(), length - written));
+        }
+    }
+
+    for (CipherMode mode : {CipherMode::GCM, CipherMode::CTR, CipherMode::CBC}) {
+        std::string modeName = mode == CipherMode::GCM ? "gcm" : mode == CipherMode::CTR ? "ctr" : "cbc";
+
+        std::vector<std::pair<std::string, FileIoOptions>> ioMethods = {
+            {"stream", {IoMethod::Stream}},
+            {"mmap", {IoMethod::Mmap}},
+            {"threads", {IoMethod::Threads}},
+            {"threads-direct", {IoMethod::Threads, true}}
+        };
+
+        if (ASYNC_FILE_IO && AsyncFileIo(IoMethod::Auto, 2).usesRing()) {
+            ioMethods.push_back({"uring", {IoMethod::Uring}});
+            ioMethods.push_back({"uring-direct", {IoMethod::Uring, true}});
+        }
+
+        EncryptionOptions streamFormat{mode, 0};
+        EncryptionOptions chunkedFormat{mode};
+        EncryptionOptions chunkedAes256{mode, chunkedFormat.chunkSize, CipherVariant::Aes256};
+
+        for (const auto& [ioName, io] : ioMethods) {
+            runner.run("file/" + modeName + "/" + ioName + "/" + label, 2.0 * length, [&]() { // Encrypt then decrypt, which also puts the file back for the next iteration
+                processFile(filePath, keys, streamFormat, io, &pool);
+                processFile(filePath + encryptedExtension, keys, streamFormat, io, &pool);
+            });
+        }
+
+        runner.run("file/" + modeName + "/chunked/" + label, 2.0 * length, [&]() { // Chunks on the pool's threads, read and written at their own offsets
+            processFile(filePath, keys, chunkedFormat, FileIoOptions{}, &pool);
+            processFile(filePath + encryptedExtension, keys, chunkedFormat, FileIoOptions{}, &pool);
+        });
+
+        for (const auto& [ioName, io] : ioMethods) { // The same I/O methods on the default format, each thread pipelines its own run of chunks
+            runner.run("file/" + modeName + "/chunked-" + ioName + "/" + label, 2.0 * length, [&]() {
+                processFile(filePath, keys, chunkedFormat, io, &pool);
+                processFile(filePath + encryptedExtension, keys, chunkedFormat, io, &pool);
+            });
+        }
+
+        runner.run("file/" + modeName + "/chunked-aes256/" + label, 2.0 * length, [&]() {
+            processFile(filePath, longKeys, chunkedAes256, FileIoOptions{}, &pool);
+            processFile(filePath + encryptedExtension, longKeys, chunkedAes256, FileIoOptions{}, &pool);
+        });
+    }
+
+    std::filesystem::remove_all(directory);
+}
+
+int main(int argc, char* argv[]) {
+    std::string filter;
+    std::string jsonPath;
+    double minTime = 0.5;
+    bool large = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--filter" && i + 1 < argc) filter = argv[++i];
+        else if (arg == "--min-time" && i + 1 < argc) minTime = std::stod(argv[++i]);
+        else if (arg == "--json" && i + 1 < argc) jsonPath = argv[++i];
+        else if (arg == "--large") large = true;
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--filter text] [--min-time seconds] [--json path] [--large]" << std::endl;
+
+            return 1;
+        }
+    }
+
+    Block<keyWordCount, rows> key = Block<keyWordCount, rows>::fromString("benchmark key 0123456789abcdef");
+    KeySchedule<cols, rows, rounds> keySchedule(key, subBox, roundConstants, mixColMatrixInv);
+    CipherShape<8>::Schedule longKeySchedule(Block<8, rows>::fromString("benchmark key 0123456789abcdef01"), subBox, CipherShape<8>::roundConstants, mixColMatrixInv);
+    ThreadPool pool(ThreadPool::defaultThreadCount());
+    BenchmarkRunner runner(filter, minTime);
+
+    std::cout << std::left << std::setw(36) << "benchmark" << std::right << std::setw(17) << "time/iter" << std::setw(17) << "throughput"
+              << std::setw(14) << "tsc/byte" << std::setw(12) << "iterations" << '\n';
+
+    benchmarkMicro(runner, keySchedule);
+    benchmarkEngine(runner, keySchedule, "engine/");
+    benchmarkEngine(runner, longKeySchedule, "engine/aes256/");
+    benchmarkCbc(runner, keySchedule, large);
+    benchmarkStreams(runner, keySchedule, pool);
+    benchmarkKeyDerivation(runner);
+    benchmarkRandom(runner);
+    benchmarkFiles(runner, pool, large);
+
+    if (!jsonPath.empty()) {
+        std::ofstream jsonFile(jsonPath);
+
+        if (!jsonFile) {
+            throw std::ios_base::failure("Failed to write to file: " + jsonPath);
+        }
+
+        runner.writeJson(jsonFile);
+    }
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+# Runs the encryptor over a scratch file in every mode so its own translation unit gets a profile too.
+# Invoked by the pgo-train target: cmake -DENCRYPTOR=<path> -DWORK_DIR=<dir> -P pgo_train.cmake
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+
+string(REPEAT "0123456789abcdef" 65536 chunk)
+file(WRITE "${WORK_DIR}/data" "")
+
+foreach(i RANGE 31)
+    file(APPEND "${WORK_DIR}/data" "${chunk}")
+endforeach()
+
+file(WRITE "${WORK_DIR}/password" "pgo-training-key\n")
+
+foreach(mode gcm ctr cbc)
+    foreach(input data data.enc)
+        execute_process(COMMAND "${ENCRYPTOR}" --mode ${mode} "${WORK_DIR}/${input}"
+            INPUT_FILE "${WORK_DIR}/password" OUTPUT_QUIET RESULT_VARIABLE result)
+
+        if(NOT result EQUAL 0)
+            message(FATAL_ERROR "Training run failed on ${input} in ${mode} mode")
+        endif()
+    endforeach()
+endforeach()
+
+file(REMOVE_RECURSE "${WORK_DIR}")
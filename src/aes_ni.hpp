@@ -0,0 +1,245 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+#include "cpu_features.hpp"
+
+template <size_t cols, size_t rows>
+class Block;
+
+template <size_t cols, size_t rows, size_t rounds>
+class KeySchedule;
+
+// What the AES instructions hard-code, engines only hand blocks to them when their own parameters match these
+constexpr std::array<uint8_t, 256> aesSubBox = { // FIPS-197 figure 7
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+constexpr std::array<uint8_t, 4> aesMixColumnRow = {2, 3, 1, 1}; // First row of the circulant MixColumns matrix
+
+#if CPU_X86
+
+template <size_t rounds>
+class AesNiKeys {
+    static constexpr size_t lanes = 8; // AESENC has a latency of several cycles but a throughput of one or two per cycle, so independent blocks are interleaved
+
+    __m128i keys[rounds + 1]; // Plain arrays, std::array would drop the vector type's alignment attributes
+    __m128i decKeys[rounds + 1]; // Equivalent inverse cipher keys, already reversed and passed through InvMixColumns for AESDEC
+
+    CPU_TARGET("aes") static __m128i loadBlock(const Block<4, 4>& block) { // Block<4, 4> stores bytes column by column, which is the AES state byte order
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(&block));
+    }
+
+    CPU_TARGET("aes") static void storeBlock(Block<4, 4>& block, __m128i value) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&block), value);
+    }
+
+    template <size_t count>
+    CPU_TARGET("aes") void encryptLanes(Block<4, 4>* blocks) const {
+        __m128i state[count];
+
+        for (size_t i = 0; i < count; i++) state[i] = _mm_xor_si128(loadBlock(blocks[i]), keys[0]);
+
+        for (size_t n = 1; n < rounds; n++) {
+            for (size_t i = 0; i < count; i++) state[i] = _mm_aesenc_si128(state[i], keys[n]);
+        }
+
+        for (size_t i = 0; i < count; i++) storeBlock(blocks[i], _mm_aesenclast_si128(state[i], keys[rounds]));
+    }
+
+    template <size_t count>
+    CPU_TARGET("aes") void decryptLanes(Block<4, 4>* blocks) const {
+        __m128i state[count];
+
+        for (size_t i = 0; i < count; i++) state[i] = _mm_xor_si128(loadBlock(blocks[i]), decKeys[0]);
+
+        for (size_t n = 1; n < rounds; n++) {
+            for (size_t i = 0; i < count; i++) state[i] = _mm_aesdec_si128(state[i], decKeys[n]);
+        }
+
+        for (size_t i = 0; i < count; i++) storeBlock(blocks[i], _mm_aesdeclast_si128(state[i], decKeys[rounds]));
+    }
+
+public:
+    CPU_TARGET("aes") explicit AesNiKeys(const KeySchedule<4, 4, rounds>& keySchedule) {
+        for (size_t n = 0; n <= rounds; n++) {
+            keys[n] = loadBlock(keySchedule.getRoundKey(n));
+        }
+
+        for (size_t n = 0; n <= rounds; n++) {
+            decKeys[n] = decryptKey(keySchedule, n);
+        }
+    }
+
+    const __m128i& getEncryptKey(size_t round) const {
+        return keys[round];
+    }
+
+    const __m128i& getDecryptKey(size_t round) const {
+        return decKeys[round];
+    }
+
+    CPU_TARGET("aes") static __m128i decryptKey(const KeySchedule<4, 4, rounds>& keySchedule, size_t step) { // Schedules built with their inverse keys already hold what AESDEC needs
+        if (keySchedule.hasInverseKeys()) return loadBlock(keySchedule.getInverseRoundKey(step));
+        if (step == 0 || step == rounds) return loadBlock(keySchedule.getRoundKey(rounds - step));
+
+        return _mm_aesimc_si128(loadBlock(keySchedule.getRoundKey(rounds - step)));
+    }
+
+    CPU_TARGET("aes") static void encryptBlock(Block<4, 4>& block, const KeySchedule<4, 4, rounds>& keySchedule) { // Single blocks read the schedule directly rather than paying for a conversion
+        __m128i state = _mm_xor_si128(loadBlock(block), loadBlock(keySchedule.getRoundKey(0)));
+
+        for (size_t n = 1; n < rounds; n++) {
+            state = _mm_aesenc_si128(state, loadBlock(keySchedule.getRoundKey(n)));
+        }
+
+        storeBlock(block, _mm_aesenclast_si128(state, loadBlock(keySchedule.getRoundKey(rounds))));
+    }
+
+    CPU_TARGET("aes") static void decryptBlock(Block<4, 4>& block, const KeySchedule<4, 4, rounds>& keySchedule) {
+        __m128i state = _mm_xor_si128(loadBlock(block), decryptKey(keySchedule, 0));
+
+        for (size_t n = 1; n < rounds; n++) {
+            state = _mm_aesdec_si128(state, decryptKey(keySchedule, n));
+        }
+
+        storeBlock(block, _mm_aesdeclast_si128(state, decryptKey(keySchedule, rounds)));
+    }
+
+    CPU_TARGET("aes") void encryptBlocks(Block<4, 4>* blocks, size_t count) const {
+        size_t i = 0;
+
+        for (; i + lanes <= count; i += lanes) encryptLanes<lanes>(blocks + i);
+        for (; i < count; i++) encryptLanes<1>(blocks + i);
+    }
+
+    CPU_TARGET("aes") void decryptBlocks(Block<4, 4>* blocks, size_t count) const {
+        size_t i = 0;
+
+        for (; i + lanes <= count; i += lanes) decryptLanes<lanes>(blocks + i);
+        for (; i < count; i++) decryptLanes<1>(blocks + i);
+    }
+};
+
+// Four blocks per instruction with the VEX/EVEX forms of the AES instructions on 512-bit registers (Ice Lake and newer, Zen 4).
+// Each round key is broadcast to all four 128-bit lanes once per batch, only for the direction the batch goes in.
+// The loop keeps 8 registers (32 blocks) in flight
+template <size_t rounds, bool decrypting = false>
+class VaesKeys {
+    static constexpr size_t lanes = 8;
+    static constexpr size_t blocksPerLane = 4;
+
+    __m512i keys[rounds + 1];
+
+    CPU_TARGET("aes,avx512f,avx512bw,vaes") static __m512i broadcast(__m128i value) { // The full zero masked form, GCC's plain _mm512_broadcast_i32x4 merges into an undefined register and warns about it
+        return _mm512_maskz_broadcast_i32x4(__mmask16(0xFFFF), value);
+    }
+
+    CPU_TARGET("aes,avx512f,avx512bw,vaes") static __m512i round(__m512i state, __m512i key) {
+        if constexpr (decrypting) return _mm512_aesdec_epi128(state, key);
+        else return _mm512_aesenc_epi128(state, key);
+    }
+
+    CPU_TARGET("aes,avx512f,avx512bw,vaes") static __m512i lastRound(__m512i state, __m512i key) {
+        if constexpr (decrypting) return _mm512_aesdeclast_epi128(state, key);
+        else return _mm512_aesenclast_epi128(state, key);
+    }
+
+    template <size_t count>
+    CPU_TARGET("aes,avx512f,avx512bw,vaes") void processLanes(Block<4, 4>* blocks) const {
+        __m512i state[count];
+
+        for (size_t i = 0; i < count; i++) state[i] = _mm512_xor_si512(_mm512_loadu_si512(blocks + i * blocksPerLane), keys[0]);
+
+        for (size_t n = 1; n < rounds; n++) {
+            for (size_t i = 0; i < count; i++) state[i] = round(state[i], keys[n]);
+        }
+
+        for (size_t i = 0; i < count; i++) _mm512_storeu_si512(blocks + i * blocksPerLane, lastRound(state[i], keys[rounds]));
+    }
+
+    CPU_TARGET("aes,avx512f,avx512bw,vaes") void processTail(Block<4, 4>* blocks, size_t count) const { // Fewer than four blocks, through byte masked loads and stores
+        __mmask64 mask = (uint64_t(1) << (count * 16)) - 1;
+        __m512i state = _mm512_xor_si512(_mm512_maskz_loadu_epi8(mask, blocks), keys[0]);
+
+        for (size_t n = 1; n < rounds; n++) state = round(state, keys[n]);
+
+        _mm512_mask_storeu_epi8(blocks, mask, lastRound(state, keys[rounds]));
+    }
+
+    template <size_t count>
+    CPU_TARGET("aes,avx512f,avx512bw,vaes") void counterLanes(Block<4, 4>* blocks, __m512i& counter, __mmask64 tailMask = ~__mmask64(0)) const { // counter holds four little endian counters, left advanced past them
+        const __m512i byteSwap = broadcast(_mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+        const __m512i step = _mm512_set_epi64(0, 4, 0, 4, 0, 4, 0, 4);
+        __m512i state[count];
+
+        for (size_t i = 0; i < count; i++) {
+            state[i] = _mm512_xor_si512(_mm512_shuffle_epi8(counter, byteSwap), keys[0]);
+            counter = _mm512_add_epi64(counter, step);
+        }
+
+        for (size_t n = 1; n < rounds; n++) {
+            for (size_t i = 0; i < count; i++) state[i] = round(state[i], keys[n]);
+        }
+
+        for (size_t i = 0; i < count; i++) _mm512_mask_storeu_epi8(blocks + i * blocksPerLane, tailMask, lastRound(state[i], keys[rounds]));
+    }
+
+    CPU_TARGET("aes,avx512f,avx512bw,vaes") void processBlocks(Block<4, 4>* blocks, size_t count) const {
+        size_t i = 0;
+
+        for (; i + lanes * blocksPerLane <= count; i += lanes * blocksPerLane) processLanes<lanes>(blocks + i);
+        for (; i + blocksPerLane <= count; i += blocksPerLane) processLanes<1>(blocks + i);
+
+        if (i < count) processTail(blocks + i, count - i);
+    }
+
+public:
+    CPU_TARGET("aes,avx512f,avx512bw,vaes") explicit VaesKeys(const KeySchedule<4, 4, rounds>& keySchedule) {
+        for (size_t n = 0; n <= rounds; n++) {
+            if constexpr (decrypting) keys[n] = broadcast(AesNiKeys<rounds>::decryptKey(keySchedule, n));
+            else keys[n] = broadcast(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&keySchedule.getRoundKey(n))));
+        }
+    }
+
+    CPU_TARGET("aes,avx512f,avx512bw,vaes") void encryptBlocks(Block<4, 4>* blocks, size_t count) const requires (!decrypting) {
+        processBlocks(blocks, count);
+    }
+
+    CPU_TARGET("aes,avx512f,avx512bw,vaes") void decryptBlocks(Block<4, 4>* blocks, size_t count) const requires decrypting {
+        processBlocks(blocks, count);
+    }
+
+    // Counter mode keystream, blocks[i] = E(first + i) with first one big endian number. The counters are built in registers, the caller makes sure
+    // the low 64 bits don't wrap within count
+    CPU_TARGET("aes,avx512f,avx512bw,vaes") void encryptCounters(Block<4, 4>* blocks, size_t count, const Block<4, 4>& first) const requires (!decrypting) {
+        __m128i firstBigEndian = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&first));
+        __m128i firstLittleEndian = _mm_shuffle_epi8(firstBigEndian, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+        __m512i counter = _mm512_add_epi64(broadcast(firstLittleEndian), _mm512_set_epi64(0, 3, 0, 2, 0, 1, 0, 0));
+        size_t i = 0;
+
+        for (; i + lanes * blocksPerLane <= count; i += lanes * blocksPerLane) counterLanes<lanes>(blocks + i, counter);
+        for (; i + blocksPerLane <= count; i += blocksPerLane) counterLanes<1>(blocks + i, counter);
+
+        if (i < count) counterLanes<1>(blocks + i, counter, (uint64_t(1) << ((count - i) * 16)) - 1);
+    }
+};
+
+#endif
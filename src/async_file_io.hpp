@@ -0,0 +1,481 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <ios>
+#include <stdexcept>
+
+#include "thread_pool.hpp"
+#include "buffer_pool.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define POSITIONAL_FILE_IO 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#else
+#define POSITIONAL_FILE_IO 0
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ASYNC_FILE_IO 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#else
+#define ASYNC_FILE_IO 0
+#endif
+
+// How files are read and written. Auto uses the io_uring pipeline when the kernel allows it, the pread/pwrite pipeline when it
+// doesn't, and plain streams on platforms without either
+enum class IoMethod : uint8_t {
+    Auto,
+    Stream,
+    Mmap,
+    Uring,
+    Threads
+};
+
+struct FileIoOptions {
+    IoMethod method = IoMethod::Auto;
+    bool directIo = false; // O_DIRECT for the pipelines, skips the page cache on filesystems that support it
+    size_t queueDepth = 4; // Chunks read ahead, and writes left in flight, per file
+
+    bool pipelined() const { // Whether reads and writes go through AsyncFileIo, the other methods use plain streams or mappings
+        return method == IoMethod::Uring || method == IoMethod::Threads || (method == IoMethod::Auto && ASYNC_FILE_IO);
+    }
+};
+
+constexpr size_t directIoAlignment = pageAlignment; // Offsets, lengths and buffers for O_DIRECT, covers both 512 and 4K sector devices
+
+// One read or write of a buffer at a file offset. Short transfers are continued by the backend until wanted bytes have moved,
+// a read may ask for more than wanted (O_DIRECT rounds lengths up) and then stops early at the end of the file
+struct IoRequest {
+    int fd = -1;
+    char* buffer = nullptr;
+    size_t length = 0;
+    uint64_t offset = 0;
+    size_t wanted = 0;
+    bool write = false;
+
+    size_t transferred = 0;
+    int error = 0; // errno of the failure, 0 on success
+    bool complete = true; // Set once the backend hands the request back, requests start idle
+
+    void reset(int fd, char* buffer, size_t length, uint64_t offset, size_t wanted, bool write) {
+        *this = IoRequest{fd, buffer, length, offset, wanted, write};
+        complete = false;
+    }
+
+    bool advance(int64_t result) { // Records one transfer result (bytes, or a negative errno), returns false while the rest still has to be requested
+        if (result == -EINTR || result == -EAGAIN) return false;
+
+        if (result < 0) {
+            error = static_cast<int>(-result);
+        } else if (result == 0) {
+            if (write) error = EIO; // Nothing written and no error, retrying would spin
+        } else {
+            transferred += result;
+
+            if (transferred < wanted) return false;
+        }
+
+        return true;
+    }
+};
+
+#if ASYNC_FILE_IO
+// Minimal io_uring driven through the raw system calls, only reads and writes of regular files are queued.
+// Throws from the constructor when the kernel lacks io_uring or has it disabled, the caller falls back to threads
+class IoRing {
+    int ringFd = -1;
+
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned unsubmitted = 0; // Entries past the tail the kernel hasn't consumed yet
+
+    void release() {
+        if (sqes != nullptr) munmap(sqes, sqesSize);
+        if (cqRing != nullptr && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != nullptr) munmap(sqRing, sqRingSize);
+        if (ringFd >= 0) close(ringFd);
+    }
+
+    void fail(const std::string& message) {
+        std::string reason = std::strerror(errno);
+
+        release();
+
+        throw std::runtime_error(message + " (" + reason + ")");
+    }
+
+    void enter(unsigned waitCount) { // Hands over every queued entry, and optionally waits for completions
+        while (true) {
+            long submitted = syscall(__NR_io_uring_enter, ringFd, unsubmitted, waitCount, waitCount > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+
+            if (submitted >= 0) {
+                unsubmitted -= static_cast<unsigned>(submitted);
+
+                return;
+            }
+
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                throw std::runtime_error(std::string("io_uring_enter failed (") + std::strerror(errno) + ")");
+            }
+        }
+    }
+
+public:
+    explicit IoRing(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+
+        if (ringFd < 0) fail("io_uring is not available");
+
+        if (!(params.features & IORING_FEAT_RW_CUR_POS)) { // Same kernel release as IORING_OP_READ and IORING_OP_WRITE
+            errno = ENOSYS;
+            fail("io_uring is too old for plain reads and writes");
+        }
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+        bool singleMapping = params.features & IORING_FEAT_SINGLE_MMAP;
+
+        if (singleMapping) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+
+        if (sqRing == MAP_FAILED) {
+            sqRing = nullptr;
+            fail("Failed to map io_uring");
+        }
+
+        cqRing = singleMapping ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+
+        if (cqRing == MAP_FAILED) {
+            cqRing = nullptr;
+            fail("Failed to map io_uring");
+        }
+
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqeMapping = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+        if (sqeMapping == MAP_FAILED) fail("Failed to map io_uring");
+
+        sqes = static_cast<io_uring_sqe*>(sqeMapping);
+
+        char* sq = static_cast<char*>(sqRing);
+        char* cq = static_cast<char*>(cqRing);
+
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    ~IoRing() {
+        release();
+    }
+
+    void submit(IoRequest& request) { // Queues the part of the request not transferred yet and hands it to the kernel straight away
+        unsigned tail = *sqTail; // Only this thread moves the tail
+        unsigned index = tail & *sqMask;
+
+        io_uring_sqe& sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = request.write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe.fd = request.fd;
+        sqe.addr = reinterpret_cast<uint64_t>(request.buffer + request.transferred);
+        sqe.len = static_cast<uint32_t>(request.length - request.transferred);
+        sqe.off = request.offset + request.transferred;
+        sqe.user_data = reinterpret_cast<uint64_t>(&request);
+
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE); // The entry must be visible before the kernel sees the new tail
+        unsubmitted++;
+
+        enter(0);
+    }
+
+    IoRequest& wait() { // Blocks until some request has fully completed, resubmitting short transfers on the way
+        while (true) {
+            unsigned head = *cqHead;
+
+            if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                enter(1);
+
+                continue;
+            }
+
+            io_uring_cqe& cqe = cqes[head & *cqMask];
+            IoRequest& request = *reinterpret_cast<IoRequest*>(cqe.user_data);
+            int64_t result = cqe.res;
+
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE); // Frees the slot, the entry was copied out above
+
+            if (request.advance(result)) return request;
+
+            submit(request);
+        }
+    }
+};
+#endif
+
+// Blocking pread and pwrite on a few dedicated threads, for kernels without io_uring. Reads ahead and writes behind still
+// overlap with the cipher, only the submissions cost a thread hand off instead of a system call
+class IoThreads {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::queue<IoRequest*> completed;
+    ThreadPool pool; // Last, so its workers are joined before the queue they report to is destroyed
+
+    static int64_t transfer(const IoRequest& request) {
+#if POSITIONAL_FILE_IO
+        ssize_t result = request.write
+            ? pwrite(request.fd, request.buffer + request.transferred, request.length - request.transferred, request.offset + request.transferred)
+            : pread(request.fd, request.buffer + request.transferred, request.length - request.transferred, request.offset + request.transferred);
+
+        return result < 0 ? -errno : result;
+#else
+        return -ENOSYS;
+#endif
+    }
+
+public:
+    explicit IoThreads(size_t threadCount) : pool(threadCount + 1) {} // The pool counts the calling thread, which never runs I/O here
+
+    void submit(IoRequest& request) {
+        pool.submit([this, &request]() {
+            while (!request.advance(transfer(request))) {}
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                completed.push(&request);
+            }
+
+            condition.notify_one();
+        });
+    }
+
+    IoRequest& wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() { return !completed.empty(); });
+
+        IoRequest* request = completed.front();
+        completed.pop();
+
+        return *request;
+    }
+};
+
+// Queue of reads and writes in flight on one of the backends above. Requests complete in any order, waitFor(request)
+// collects completions until that one is done. Destruction waits for everything still in flight, since the kernel or an
+// I/O thread may otherwise write into buffers that are already freed
+class AsyncFileIo {
+    static constexpr size_t ioThreadCount = 2; // One reading ahead while the other writes behind
+
+#if ASYNC_FILE_IO
+    std::unique_ptr<IoRing> ring;
+#endif
+    std::unique_ptr<IoThreads> threads;
+    size_t inFlight = 0;
+
+    IoRequest& next() {
+#if ASYNC_FILE_IO
+        IoRequest& request = ring ? ring->wait() : threads->wait();
+#else
+        IoRequest& request = threads->wait();
+#endif
+        request.complete = true;
+        inFlight--;
+
+        return request;
+    }
+
+public:
+    AsyncFileIo(IoMethod method, unsigned queueEntries) { // Uring fails when io_uring is unavailable, Auto falls back to threads
+#if ASYNC_FILE_IO
+        if (method != IoMethod::Threads) {
+            try {
+                ring = std::make_unique<IoRing>(queueEntries);
+
+                return;
+            } catch (const std::exception&) {
+                if (method == IoMethod::Uring) throw;
+            }
+        }
+#else
+        if (method == IoMethod::Uring) throw std::runtime_error("io_uring is not supported on this platform");
+#endif
+
+        threads = std::make_unique<IoThreads>(ioThreadCount);
+    }
+
+    AsyncFileIo(const AsyncFileIo&) = delete;
+    AsyncFileIo& operator=(const AsyncFileIo&) = delete;
+
+    ~AsyncFileIo() {
+        try {
+            while (inFlight > 0) next();
+        } catch (...) {} // Only a failing io_uring_enter gets here, nothing left to wait with
+    }
+
+    bool usesRing() const {
+#if ASYNC_FILE_IO
+        return ring != nullptr;
+#else
+        return false;
+#endif
+    }
+
+    void submit(IoRequest& request) { // request must stay alive and untouched until it completes
+#if ASYNC_FILE_IO
+        if (ring) ring->submit(request);
+        else threads->submit(request);
+#else
+        threads->submit(request);
+#endif
+        inFlight++;
+    }
+
+    void waitFor(IoRequest& request) {
+        while (!request.complete) next();
+    }
+};
+
+// File descriptor opened for the pipelines and for positional reads and writes. Direct I/O is dropped again when the filesystem
+// refuses it (tmpfs, some network filesystems), so asking for it is always safe and isDirect() says whether the alignment rules apply
+class IoFile {
+    std::string filePath;
+    int fd = -1;
+    bool direct = false;
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::ios_base::failure(message + filePath + " (" + std::strerror(errno) + ")");
+    }
+
+public:
+    IoFile(const std::string& filePath, bool writing, bool tryDirect) : filePath(filePath) {
+#if POSITIONAL_FILE_IO
+        int flags = writing ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY;
+
+#ifdef O_DIRECT
+        if (tryDirect) {
+            fd = open(filePath.c_str(), flags | O_DIRECT | O_CLOEXEC, 0600);
+            direct = fd >= 0;
+        }
+#endif
+
+        if (fd < 0) fd = open(filePath.c_str(), flags | O_CLOEXEC, 0600);
+
+        if (fd < 0) fail(writing ? "Failed to write to file: " : "Failed to read from file: ");
+#else
+        throw std::runtime_error("Positional file I/O is not supported on this platform");
+#endif
+    }
+
+    IoFile(const IoFile&) = delete;
+    IoFile& operator=(const IoFile&) = delete;
+
+    ~IoFile() {
+#if POSITIONAL_FILE_IO
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    int get() const {
+        return fd;
+    }
+
+    const std::string& getPath() const {
+        return filePath;
+    }
+
+    bool isDirect() const {
+        return direct;
+    }
+
+    size_t alignment() const {
+        return direct ? directIoAlignment : 1;
+    }
+
+    uint64_t size() const {
+#if POSITIONAL_FILE_IO
+        struct stat info;
+
+        if (fstat(fd, &info) != 0) fail("Failed to stat file: ");
+
+        return info.st_size;
+#else
+        return 0;
+#endif
+    }
+
+    void sync() const { // Before the file is renamed into place, so a crash can't leave the new name on data that never reached the disk
+#if POSITIONAL_FILE_IO
+        if (fsync(fd) != 0) fail("Failed to sync file: ");
+#endif
+    }
+
+    void truncate(uint64_t length) { // Trims the zero padding of the last direct write
+#if POSITIONAL_FILE_IO
+        if (ftruncate(fd, length) != 0) fail("Failed to size file: ");
+#endif
+    }
+
+    void readAt(char* buffer, size_t length, uint64_t offset) const { // Blocking, safe to call from several threads at once
+#if POSITIONAL_FILE_IO
+        for (size_t done = 0; done < length;) {
+            ssize_t result = pread(fd, buffer + done, length - done, offset + done);
+
+            if (result < 0 && errno == EINTR) continue;
+            if (result < 0) fail("Failed to read from file: ");
+            if (result == 0) throw std::runtime_error("File is shorter than expected: " + filePath);
+
+            done += result;
+        }
+#endif
+    }
+
+    void writeAt(const char* buffer, size_t length, uint64_t offset) const {
+#if POSITIONAL_FILE_IO
+        for (size_t done = 0; done < length;) {
+            ssize_t result = pwrite(fd, buffer + done, length - done, offset + done);
+
+            if (result < 0 && errno == EINTR) continue;
+            if (result <= 0) fail("Failed to write to file: ");
+
+            done += result;
+        }
+#endif
+    }
+};
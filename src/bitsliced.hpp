@@ -0,0 +1,420 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#include "gf256.hpp"
+#include "matrix.hpp"
+#include "aes_ni.hpp"
+#include "cpu_features.hpp"
+#include "util.hpp"
+
+template <size_t cols, size_t rows>
+class Block;
+
+template <size_t cols, size_t rows, size_t rounds>
+class KeySchedule;
+
+// Everything the bitsliced circuit needs, derived from the engine's own substitution box and matrices rather than hard-coded for AES
+struct BitslicedParameters {
+    std::array<uint8_t, 8> affine{}; // affine[k] = image of bit k under the linear part of the S-box affine transform
+    std::array<uint8_t, 8> affineInv{};
+    uint8_t affineConstant = 0;
+    uint8_t reduction = 0; // x^8 reduced by the field polynomial, folds the high half of a product back down
+    std::array<std::array<uint8_t, 8>, 4> mix{}; // mix[d][k] = (d-th coefficient of the circulant row) * x^k
+    std::array<std::array<uint8_t, 8>, 4> mixInv{};
+    bool valid = false; // Only circulant matrices and a substitution box of the form affine(inv(x)) can be evaluated as a circuit
+
+    constexpr bool operator==(const BitslicedParameters& other) const = default;
+
+    static constexpr bool isCirculant(const Matrix<4>& mat) {
+        for (int r = 0; r < 4; r++) {
+            for (int c = 0; c < 4; c++) {
+                if (mat[r][c].get() != mat[0][mod(c - r, 4)].get()) return false;
+            }
+        }
+
+        return true;
+    }
+
+    static constexpr std::array<std::array<uint8_t, 8>, 4> multiplierBits(const Matrix<4>& mat) {
+        std::array<std::array<uint8_t, 8>, 4> bits{};
+
+        for (int d = 0; d < 4; d++) {
+            for (int k = 0; k < 8; k++) {
+                bits[d][k] = (mat[0][d] * GF256(1 << k)).get();
+            }
+        }
+
+        return bits;
+    }
+
+    static constexpr uint8_t applyLinear(const std::array<uint8_t, 8>& columns, uint8_t value) {
+        uint8_t result = 0;
+
+        for (int k = 0; k < 8; k++) {
+            if (value & (1 << k)) result ^= columns[k];
+        }
+
+        return result;
+    }
+
+    static constexpr BitslicedParameters derive(const std::array<uint8_t, 256>& subTable, const std::array<uint8_t, 256>& subInvTable, const Matrix<4>& mixColMatrix, const Matrix<4>& mixColMatrixInv) {
+        BitslicedParameters params;
+
+        // sub(x) = L(inv(x)) + c, so c = sub(0), L(e_k) = sub(inv(e_k)) + c and L^-1(e_k) = inv(subInv(e_k + c))
+        params.affineConstant = subTable[0];
+        params.reduction = (GF256(0x80) * GF256(2)).get();
+
+        for (int k = 0; k < 8; k++) {
+            params.affine[k] = subTable[GF256(1 << k).inv().get()] ^ params.affineConstant;
+            params.affineInv[k] = GF256(subInvTable[(1 << k) ^ params.affineConstant]).inv().get();
+        }
+
+        params.mix = multiplierBits(mixColMatrix);
+        params.mixInv = multiplierBits(mixColMatrixInv);
+        params.valid = isCirculant(mixColMatrix) && isCirculant(mixColMatrixInv);
+
+        for (int x = 0; x < 256; x++) { // The derivation above only holds if the box really is affine over the inverse
+            if (applyLinear(params.affine, GF256(x).inv().get()) != (subTable[x] ^ params.affineConstant)) params.valid = false;
+        }
+
+        return params;
+    }
+};
+
+constexpr BitslicedParameters aesBitslicedParameters = []() constexpr {
+    std::array<uint8_t, 256> subInvTable{};
+
+    for (int x = 0; x < 256; x++) {
+        subInvTable[aesSubBox[x]] = x;
+    }
+
+    Matrix<4> mixColMatrix = Matrix<4>::createCirculantMatrix(Vector<4>({aesMixColumnRow[0], aesMixColumnRow[1], aesMixColumnRow[2], aesMixColumnRow[3]}));
+
+    return BitslicedParameters::derive(aesSubBox, subInvTable, mixColMatrix, mixColMatrix.inverse());
+}();
+
+#if CPU_X86 && defined(__GNUC__)
+#define BITSLICED_ENGINE 1
+
+template <size_t width>
+struct BitslicedRegister; // GCC ignores vector_size with a dependent width, so each register size is spelled out
+
+template <>
+struct BitslicedRegister<16> {
+    typedef uint8_t Bytes __attribute__((vector_size(16)));
+    typedef uint64_t Lanes __attribute__((vector_size(16)));
+};
+
+template <>
+struct BitslicedRegister<32> {
+    typedef uint8_t Bytes __attribute__((vector_size(32)));
+    typedef uint64_t Lanes __attribute__((vector_size(32)));
+};
+
+// Bitsliced rounds over 128 or 256 bit registers. Bit plane j holds bit j of every byte of width / 2 blocks, with byte k of a plane
+// being byte k of each block (one block per bit), so ShiftRows and the MixColumns rotations become byte shuffles and SubBytes becomes
+// a fixed sequence of AND/XOR gates with no secret-dependent memory access. All members are force inlined so they compile with the
+// instruction set of the CPU_TARGET entry point below that uses them.
+template <size_t width>
+class Bitsliced {
+    using Vec = typename BitslicedRegister<width>::Bytes;
+    using Lanes = typename BitslicedRegister<width>::Lanes;
+
+    struct Planes {
+        Vec bits[8];
+    };
+
+public:
+    static constexpr size_t blockCount = width / 2;
+
+private:
+    template <typename Map>
+    [[gnu::always_inline]] static inline void makeShuffle(Vec& mask, Map map) { // Same byte permutation within each 16 byte lane
+        for (size_t i = 0; i < width; i++) {
+            mask[i] = (i & ~15) + map(i & 15);
+        }
+    }
+
+    [[gnu::always_inline]] static inline void shuffle(Planes& state, const Vec& mask) {
+        #pragma GCC unroll 16
+        for (int j = 0; j < 8; j++) {
+            state.bits[j] = __builtin_shuffle(state.bits[j], mask);
+        }
+    }
+
+    [[gnu::always_inline]] static inline void swapMove(Vec& a, Vec& b, int n, uint8_t mask) {
+        Vec t = (reinterpret_cast<Vec>(reinterpret_cast<Lanes>(a) >> n) ^ b) & mask;
+
+        b ^= t;
+        a ^= reinterpret_cast<Vec>(reinterpret_cast<Lanes>(t) << n);
+    }
+
+    [[gnu::always_inline]] static inline void transpose(Planes& state) { // 8x8 bit transpose within every byte, its own inverse
+        static constexpr uint8_t masks[3] = {0x55, 0x33, 0x0F};
+
+        #pragma GCC unroll 16
+        for (int s = 0; s < 3; s++) {
+            int n = 1 << s;
+
+            #pragma GCC unroll 16
+            for (int i = 0; i < 8; i++) {
+                if (!(i & n)) swapMove(state.bits[i], state.bits[i + n], n, masks[s]);
+            }
+        }
+    }
+
+    [[gnu::always_inline]] static inline void load(Planes& state, const Block<4, 4>* blocks, size_t count) {
+        state = {};
+
+        for (size_t b = 0; b < count; b++) {
+            std::memcpy(reinterpret_cast<uint8_t*>(&state.bits[b % 8]) + (b / 8) * 16, &blocks[b], 16);
+        }
+
+        transpose(state);
+    }
+
+    [[gnu::always_inline]] static inline void store(Planes& state, Block<4, 4>* blocks, size_t count) {
+        transpose(state);
+
+        for (size_t b = 0; b < count; b++) {
+            std::memcpy(&blocks[b], reinterpret_cast<const uint8_t*>(&state.bits[b % 8]) + (b / 8) * 16, 16);
+        }
+    }
+
+    [[gnu::always_inline]] static inline void expandKey(Planes& planes, const Block<4, 4>& key) { // Every block sees the same key byte, so each bit becomes 0x00 or 0xFF
+        Vec keyBytes;
+
+        for (size_t i = 0; i < width; i += 16) {
+            std::memcpy(reinterpret_cast<uint8_t*>(&keyBytes) + i, &key, 16);
+        }
+
+        #pragma GCC unroll 16
+        for (int j = 0; j < 8; j++) {
+            planes.bits[j] = -((keyBytes >> j) & 1);
+        }
+    }
+
+    [[gnu::always_inline]] static inline void addKey(Planes& state, const Planes& key) {
+        #pragma GCC unroll 16
+        for (int j = 0; j < 8; j++) {
+            state.bits[j] ^= key.bits[j];
+        }
+    }
+
+    [[gnu::always_inline]] static inline void reduce(Vec (&product)[15], Planes& out, uint8_t reduction) {
+        #pragma GCC unroll 16
+        for (int k = 14; k >= 8; k--) {
+            #pragma GCC unroll 16
+            for (int t = 0; t < 8; t++) {
+                if (reduction & (1 << t)) product[k - 8 + t] ^= product[k];
+            }
+        }
+
+        #pragma GCC unroll 16
+        for (int j = 0; j < 8; j++) {
+            out.bits[j] = product[j];
+        }
+    }
+
+    [[gnu::always_inline]] static inline void multiply(const Planes& a, const Planes& b, Planes& out, uint8_t reduction) {
+        Vec product[15] = {};
+
+        #pragma GCC unroll 16
+        for (int i = 0; i < 8; i++) {
+            #pragma GCC unroll 16
+            for (int j = 0; j < 8; j++) {
+                product[i + j] ^= a.bits[i] & b.bits[j];
+            }
+        }
+
+        reduce(product, out, reduction);
+    }
+
+    [[gnu::always_inline]] static inline void square(const Planes& a, Planes& out, uint8_t reduction) { // Squaring is linear in characteristic 2, coefficients just spread out
+        Vec product[15] = {};
+
+        #pragma GCC unroll 16
+        for (int i = 0; i < 8; i++) {
+            product[2 * i] = a.bits[i];
+        }
+
+        reduce(product, out, reduction);
+    }
+
+    [[gnu::always_inline]] static inline void invert(Planes& state, uint8_t reduction) { // x^254 = x^-1 (and 0 -> 0), with 4 multiplications and 7 squarings
+        Planes x2, x3, x12, t;
+
+        square(state, x2, reduction);
+        multiply(x2, state, x3, reduction);
+        square(x3, t, reduction); // x^6
+        square(t, x12, reduction);
+        multiply(x12, x3, t, reduction); // x^15
+
+        for (int i = 0; i < 4; i++) {
+            square(t, t, reduction); // x^240 after four squarings
+        }
+
+        multiply(t, x12, t, reduction); // x^252
+        multiply(t, x2, state, reduction);
+    }
+
+    [[gnu::always_inline]] static inline void applyLinear(const std::array<uint8_t, 8>& columns, const Planes& in, Planes& out) {
+        Planes result = {};
+
+        #pragma GCC unroll 16
+        for (int k = 0; k < 8; k++) {
+            #pragma GCC unroll 16
+            for (int j = 0; j < 8; j++) {
+                if (columns[k] & (1 << j)) result.bits[j] ^= in.bits[k];
+            }
+        }
+
+        out = result;
+    }
+
+    [[gnu::always_inline]] static inline void addConstant(Planes& state, uint8_t constant) {
+        #pragma GCC unroll 16
+        for (int j = 0; j < 8; j++) {
+            if (constant & (1 << j)) state.bits[j] = ~state.bits[j];
+        }
+    }
+
+    [[gnu::always_inline]] static inline void subBytes(Planes& state, const BitslicedParameters& params) {
+        invert(state, params.reduction);
+        applyLinear(params.affine, state, state);
+        addConstant(state, params.affineConstant);
+    }
+
+    [[gnu::always_inline]] static inline void subBytesInv(Planes& state, const BitslicedParameters& params) {
+        addConstant(state, params.affineConstant);
+        applyLinear(params.affineInv, state, state);
+        invert(state, params.reduction);
+    }
+
+    [[gnu::always_inline]] static inline void mixColumns(Planes& state, const std::array<std::array<uint8_t, 8>, 4>& multipliers) {
+        Planes result = {};
+
+        #pragma GCC unroll 16
+        for (int d = 0; d < 4; d++) { // Row i of each column picks up coefficient d times row i + d
+            Planes rotated = state;
+            Planes scaled;
+            Vec rotation;
+
+            makeShuffle(rotation, [d](size_t i) { return (i & ~3) + ((i + d) & 3); });
+            shuffle(rotated, rotation);
+            applyLinear(multipliers[d], rotated, scaled);
+
+            #pragma GCC unroll 16
+            for (int j = 0; j < 8; j++) {
+                result.bits[j] ^= scaled.bits[j];
+            }
+        }
+
+        state = result;
+    }
+
+public:
+    template <size_t rounds>
+    [[gnu::always_inline]] static inline void encryptBlocks(Block<4, 4>* blocks, size_t count, const KeySchedule<4, 4, rounds>& keySchedule, const BitslicedParameters& params) {
+        Vec shiftRows;
+        makeShuffle(shiftRows, [](size_t i) { return mod(i / 4 + i % 4, 4) * 4 + i % 4; });
+
+        Planes roundKeys[rounds + 1];
+
+        for (size_t n = 0; n <= rounds; n++) {
+            expandKey(roundKeys[n], keySchedule.getRoundKey(n));
+        }
+
+        for (size_t start = 0; start < count; start += blockCount) {
+            size_t batch = count - start < blockCount ? count - start : blockCount;
+            Planes state;
+
+            load(state, blocks + start, batch);
+            addKey(state, roundKeys[0]);
+
+            for (size_t n = 1; n <= rounds; n++) {
+                subBytes(state, params);
+                shuffle(state, shiftRows);
+
+                if (n != rounds) mixColumns(state, params.mix);
+
+                addKey(state, roundKeys[n]);
+            }
+
+            store(state, blocks + start, batch);
+        }
+    }
+
+    template <size_t rounds>
+    [[gnu::always_inline]] static inline void decryptBlocks(Block<4, 4>* blocks, size_t count, const KeySchedule<4, 4, rounds>& keySchedule, const BitslicedParameters& params) {
+        Vec shiftRowsInv;
+        makeShuffle(shiftRowsInv, [](size_t i) { return mod(static_cast<int>(i / 4) - static_cast<int>(i % 4), 4) * 4 + i % 4; });
+
+        Planes roundKeys[rounds + 1];
+
+        for (size_t n = 0; n <= rounds; n++) {
+            expandKey(roundKeys[n], keySchedule.getRoundKey(n));
+        }
+
+        for (size_t start = 0; start < count; start += blockCount) {
+            size_t batch = count - start < blockCount ? count - start : blockCount;
+            Planes state;
+
+            load(state, blocks + start, batch);
+
+            for (size_t n = rounds; n >= 1; n--) {
+                addKey(state, roundKeys[n]);
+
+                if (n != rounds) mixColumns(state, params.mixInv);
+
+                shuffle(state, shiftRowsInv);
+                subBytesInv(state, params);
+            }
+
+            addKey(state, roundKeys[0]);
+            store(state, blocks + start, batch);
+        }
+    }
+};
+
+template <size_t rounds>
+CPU_TARGET("ssse3") void bitslicedEncryptSSSE3(Block<4, 4>* blocks, size_t count, const KeySchedule<4, 4, rounds>& keySchedule, const BitslicedParameters& params) {
+    if (params == aesBitslicedParameters) {
+        Bitsliced<16>::encryptBlocks(blocks, count, keySchedule, aesBitslicedParameters); // Known at compile time, every parameter branch in the circuit folds away
+    } else {
+        Bitsliced<16>::encryptBlocks(blocks, count, keySchedule, params);
+    }
+}
+
+template <size_t rounds>
+CPU_TARGET("ssse3") void bitslicedDecryptSSSE3(Block<4, 4>* blocks, size_t count, const KeySchedule<4, 4, rounds>& keySchedule, const BitslicedParameters& params) {
+    if (params == aesBitslicedParameters) {
+        Bitsliced<16>::decryptBlocks(blocks, count, keySchedule, aesBitslicedParameters); // Known at compile time, every parameter branch in the circuit folds away
+    } else {
+        Bitsliced<16>::decryptBlocks(blocks, count, keySchedule, params);
+    }
+}
+
+template <size_t rounds>
+CPU_TARGET("avx2") void bitslicedEncryptAVX2(Block<4, 4>* blocks, size_t count, const KeySchedule<4, 4, rounds>& keySchedule, const BitslicedParameters& params) {
+    if (params == aesBitslicedParameters) {
+        Bitsliced<32>::encryptBlocks(blocks, count, keySchedule, aesBitslicedParameters); // Known at compile time, every parameter branch in the circuit folds away
+    } else {
+        Bitsliced<32>::encryptBlocks(blocks, count, keySchedule, params);
+    }
+}
+
+template <size_t rounds>
+CPU_TARGET("avx2") void bitslicedDecryptAVX2(Block<4, 4>* blocks, size_t count, const KeySchedule<4, 4, rounds>& keySchedule, const BitslicedParameters& params) {
+    if (params == aesBitslicedParameters) {
+        Bitsliced<32>::decryptBlocks(blocks, count, keySchedule, aesBitslicedParameters); // Known at compile time, every parameter branch in the circuit folds away
+    } else {
+        Bitsliced<32>::decryptBlocks(blocks, count, keySchedule, params);
+    }
+}
+
+#endif
@@ -7,6 +7,7 @@
 #include "substitution_box.hpp"
 #include "vector.hpp"
 #include "key_schedule.hpp"
+#include "round_engine.hpp"
 #include "util.hpp"
 
 template <size_t cols, size_t rows, size_t rounds>
@@ -14,8 +15,41 @@ class KeySchedule;
 
 template <size_t cols, size_t rows>
 class Block {
+    static constexpr size_t byteCount = cols * rows;
+
+    using Permutation = std::array<uint8_t, byteCount>;
+
     std::array<Vector<rows>, cols> words;
 
+    static constexpr Permutation makeShiftPermutation(int direction) { // Entry i is the byte that moves into byte i, bytes numbered column by column
+        Permutation permutation{};
+
+        for (size_t c = 0; c < cols; c++) {
+            for (size_t r = 0; r < rows; r++) {
+                permutation[c * rows + r] = mod(c + rowShift(cols, r) * direction, cols) * rows + r; // Shift row by its row shift in the correct direction
+            }
+        }
+
+        return permutation;
+    }
+
+    static constexpr Permutation shiftPermutation = makeShiftPermutation(1);
+    static constexpr Permutation shiftPermutationInv = makeShiftPermutation(-1);
+
+    static_assert(byteCount <= 256, "Permutation entries are stored as bytes");
+    static_assert(sizeof(std::array<Vector<rows>, cols>) == byteCount, "Bytes must be contiguous to be substituted in one pass");
+
+    template <const Permutation& permutation>
+    void permute() { // Every index is a constant, so this becomes byteCount plain moves
+        std::array<Vector<rows>, cols> source = words;
+
+        unroll<byteCount>([&](auto i) {
+            constexpr size_t from = permutation[decltype(i)::value];
+
+            words[i / rows][i % rows] = source[from / rows][from % rows];
+        });
+    }
+
 public:
     Block() : words{} {}
     Block(std::array<Vector<rows>, cols> values) : words(values) {}
@@ -25,8 +59,8 @@ public:
 
         Block<cols, rows> block;
 
-        for (int c = 0; c < cols; c++) {
-            for (int r = 0; r < rows; r++) {
+        for (size_t c = 0; c < cols; c++) {
+            for (size_t r = 0; r < rows; r++) {
                 block.words[c][r] = str[(c * rows + r) % len];
             }
         }
@@ -43,69 +77,71 @@ public:
     }
 
     void addKey(const Block<cols, rows>& key) {
-        for (int i = 0; i < cols; i++) {
-            words[i] += key.words[i];
-        }
+        unroll<cols>([&](auto c) {
+            words[c] += key.words[c];
+        });
     }
 
-    void subBytes(const SubstitutionBox& subBox, bool inverse = false) {
-        for (int i = 0; i < cols; i++) {
-            words[i].subWord(subBox, inverse);
-        }
+    void subBytes(const SubstitutionBox& subBox, bool inverse = false) { // All bytes in one call, so SIMD shuffles can replace per byte lookups
+        GF256* bytes = reinterpret_cast<GF256*>(words.data());
+
+        if (inverse) subBox.substitute<true>(bytes, byteCount);
+        else subBox.substitute<false>(bytes, byteCount);
     }
 
     void shiftRows(bool invDir = false) {
-        std::array<Vector<rows>, cols> tempValues = words;
-
-        int direction = invDir ? -1 : 1;
-
-        for (int r = 0; r < rows; r++) {
-            for (int c = 0; c < cols; c++) {
-                int shiftedCol = mod(c + r * direction, cols); // Shift row an amount equal to the corresponding row number in the correct direction
-
-                words[c][r] = tempValues[shiftedCol][r];
-            }
-        }
+        if (invDir) permute<shiftPermutationInv>();
+        else permute<shiftPermutation>();
     }
 
     void mixColumns(const Matrix<rows>& mat) {
-        for (int i = 0; i < cols; i++) {
-            words[i] *= mat;
-        }
+        unroll<cols>([&](auto c) {
+            words[c] *= mat;
+        });
     }
 
     template <size_t rounds>
     void encrypt(const KeySchedule<cols, rows, rounds>& keySchedule, const SubstitutionBox& subBox, const Matrix<rows>& mixColMatrix) {
         addKey(keySchedule.getRoundKey(0));
 
-        for (int n = 1; n <= rounds; n++) {
+        unroll<rounds - 1>([&](auto n) { // Every round but the last mixes columns, unrolled so that choice is never made at run time
             subBytes(subBox);
             shiftRows();
+            mixColumns(mixColMatrix);
+            addKey(keySchedule.getRoundKey(n + 1));
+        });
 
-            if (n != rounds) {
-                mixColumns(mixColMatrix);
-            }
-
-            addKey(keySchedule.getRoundKey(n));
-        }
+        subBytes(subBox);
+        shiftRows();
+        addKey(keySchedule.getRoundKey(rounds));
     }
 
     template <size_t rounds>
     void decrypt(const KeySchedule<cols, rows, rounds>& keySchedule, const SubstitutionBox& subBox, const Matrix<rows>& mixColMatrixInv) {
-        for (int n = rounds; n >= 1; n--) {
-            addKey(keySchedule.getRoundKey(n));
-
-            if (n != rounds) {
-                mixColumns(mixColMatrixInv);
-            }
+        addKey(keySchedule.getRoundKey(rounds));
+        shiftRows(true);
+        subBytes(subBox, true);
 
+        unroll<rounds - 1>([&](auto n) {
+            addKey(keySchedule.getRoundKey(rounds - 1 - n));
+            mixColumns(mixColMatrixInv);
             shiftRows(true);
             subBytes(subBox, true);
-        }
+        });
 
         addKey(keySchedule.getRoundKey(0));
     }
 
+    template <size_t rounds>
+    void encrypt(const KeySchedule<cols, rows, rounds>& keySchedule, const RoundEngine<rows>& engine) { // Uses the fused table rounds when the engine has them, otherwise the steps above
+        engine.encrypt(*this, keySchedule);
+    }
+
+    template <size_t rounds>
+    void decrypt(const KeySchedule<cols, rows, rounds>& keySchedule, const RoundEngine<rows>& engine) {
+        engine.decrypt(*this, keySchedule);
+    }
+
     void print(std::ostream& stream, GFFormat format = GFFormat::Hex) const {
         for (int r = 0; r < rows; r++) {
             if (r > 0) stream << '\n';
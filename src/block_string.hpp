@@ -3,98 +3,190 @@
 #include <string>
 #include <vector>
 #include <array>
+#include <span>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
 
 #include "substitution_box.hpp"
 #include "block.hpp"
-#include "matrix.hpp"
+#include "round_engine.hpp"
+#include "thread_pool.hpp"
+#include "buffer_pool.hpp"
 
+// Blocks viewed in place over one contiguous byte buffer, either pooled and owned (the padded copy of some text) or a
+// caller's own buffer. Encrypting a caller's buffer through the span constructor allocates and copies nothing
 template <size_t cols, size_t rows>
 class BlockString {
-    std::vector<Block<cols, rows>> blocks;
+    static constexpr size_t batchSize = 64; // Blocks handed to the engine at once when the mode allows it
+    static constexpr size_t blockSize = cols * rows;
+
+    static_assert(sizeof(Block<cols, rows>) == blockSize && alignof(Block<cols, rows>) == 1, "Blocks must be plain bytes to be viewed in place");
+
+    PooledBuffer storage; // Empty when viewing a caller's buffer
+    std::span<Block<cols, rows>> blocks;
+
+    static std::span<Block<cols, rows>> viewBlocks(std::byte* data, size_t length) { // Block only holds bytes and has a trivial copy, so it may live in any byte storage
+        return std::span<Block<cols, rows>>(reinterpret_cast<Block<cols, rows>*>(data), length / blockSize);
+    }
 
 public:
-    BlockString(const std::string& text, bool encrypted) {
-        size_t blockSize = cols * rows;
-        size_t textLength = text.length();
+    static size_t paddedLength(size_t length) { // PKCS#7 always adds between 1 and blockSize bytes
+        return (length / blockSize + 1) * blockSize;
+    }
+
+    static size_t pad(std::span<std::byte> buffer, size_t length) { // Pads the first length bytes of buffer in place, returns the padded length
+        size_t padded = paddedLength(length);
+
+        if (buffer.size() < padded) {
+            throw std::invalid_argument("Buffer has no room for the padding");
+        }
 
-        size_t padLength = blockSize - textLength % blockSize;
-        if (encrypted) padLength -= blockSize;
-        else if (padLength == 0) padLength = blockSize;
+        std::memset(buffer.data() + length, static_cast<int>(padded - length), padded - length);
 
-        size_t blockCount = (textLength + padLength) / blockSize;
+        return padded;
+    }
 
-        for (int b = 0; b < blockCount; b++) {
-            Block<cols, rows> block;
+    static size_t unpaddedLength(std::span<const std::byte> bytes) { // Length without valid PKCS#7 padding, invalid padding is left in place
+        if (bytes.empty()) return 0;
 
-            for (int i = 0; i < blockSize; i++) {
-                int charIndex = b * blockSize + i;
+        size_t padLength = static_cast<uint8_t>(bytes.back());
 
-                block[i / rows][i % rows] = charIndex < textLength ? static_cast<GF256>(text[charIndex]) : static_cast<GF256>(padLength);
-            }
+        if (padLength > bytes.size()) return bytes.size();
 
-            blocks.push_back(block);
+        for (size_t i = bytes.size() - padLength; i < bytes.size(); i++) {
+            if (static_cast<uint8_t>(bytes[i]) != padLength) return bytes.size();
         }
+
+        return bytes.size() - padLength;
     }
 
-    template <size_t rounds>
-    void cbcEncrypt(const KeySchedule<cols, rows, rounds>& keySchedule, const SubstitutionBox& subBox, const Matrix<rows>& mixColMatrix, const Block<cols, rows>& ivBlock) {
-        Block<cols, rows> prevBlock = ivBlock;
+    explicit BlockString(std::span<std::byte> data) : blocks(viewBlocks(data.data(), data.size())) { // Works on data in place, which must be whole blocks (padded or ciphertext)
+        if (data.size() % blockSize != 0) {
+            throw std::invalid_argument("Data length is not a multiple of the block size");
+        }
+    }
 
-        for (Block<cols, rows>& block : blocks) {
-            block.addKey(prevBlock);
-            block.encrypt(keySchedule, subBox, mixColMatrix);
+    BlockString(std::span<const std::byte> text, bool encrypted, BufferPool& pool = BufferPool::shared()) { // Copies text once into pooled memory, padding it unless it is ciphertext
+        if (encrypted && text.size() % blockSize != 0) {
+            throw std::invalid_argument("Ciphertext length is not a multiple of the block size");
+        }
+
+        size_t length = encrypted ? text.size() : paddedLength(text.size());
+
+        storage = pool.acquire(length);
+
+        if (!text.empty()) std::memcpy(storage.get(), text.data(), text.size());
+        if (!encrypted) pad(std::span<std::byte>(storage.get(), length), text.size());
+
+        blocks = viewBlocks(storage.get(), length);
+    }
+
+    BlockString(const std::string& text, bool encrypted) : BlockString(std::as_bytes(std::span(text)), encrypted) {}
 
-            prevBlock = block;
+    template <size_t rounds> // Chains from chainBlock and leaves the last ciphertext block in it, so a stream can continue across calls
+    static void cbcEncryptBlocks(Block<cols, rows>* blocks, size_t count, const KeySchedule<cols, rows, rounds>& keySchedule, const RoundEngine<rows>& engine, Block<cols, rows>& chainBlock) {
+        for (size_t i = 0; i < count; i++) {
+            blocks[i].addKey(chainBlock);
+            blocks[i].encrypt(keySchedule, engine);
+
+            chainBlock = blocks[i];
         }
     }
 
     template <size_t rounds>
-    void cbcDecrypt(const KeySchedule<cols, rows, rounds>& keySchedule, const SubstitutionBox& subBox, const Matrix<rows>& mixColMatrixInv, const Block<cols, rows>& ivBlock) {
-        Block<cols, rows> prevBlock = ivBlock;
+    static void cbcDecryptBlocks(Block<cols, rows>* blocks, size_t count, const KeySchedule<cols, rows, rounds>& keySchedule, const RoundEngine<rows>& engine, Block<cols, rows>& chainBlock) {
+        std::array<Block<cols, rows>, batchSize> cipherBlocks;
+
+        for (size_t start = 0; start < count; start += batchSize) { // Decryption has no chaining dependency, so batches go through the engine together
+            size_t batch = std::min(batchSize, count - start);
 
-        for (Block<cols, rows>& block : blocks) {
-            Block<cols, rows> cipherBlock = block;
+            std::copy_n(blocks + start, batch, cipherBlocks.begin());
+            engine.decryptBlocks(blocks + start, batch, keySchedule);
 
-            block.decrypt(keySchedule, subBox, mixColMatrixInv);
-            block.addKey(prevBlock);
+            for (size_t i = 0; i < batch; i++) {
+                blocks[start + i].addKey(i == 0 ? chainBlock : cipherBlocks[i - 1]);
+            }
 
-            prevBlock = cipherBlock;
+            chainBlock = cipherBlocks[batch - 1];
         }
     }
 
-    std::string getText(bool removePKCS7PPadding = false) {
-        std::string text;
-        text.reserve(blocks.size() * cols * rows);
+    template <size_t rounds> // Same result as cbcDecryptBlocks, with the blocks split into one contiguous range per pool thread
+    static void cbcDecryptBlocks(Block<cols, rows>* blocks, size_t count, const KeySchedule<cols, rows, rounds>& keySchedule, const RoundEngine<rows>& engine, Block<cols, rows>& chainBlock, ThreadPool& pool) {
+        size_t rangeCount = std::min(pool.size(), count);
 
-        for (Block<cols, rows> block : blocks) {
-            for (int c = 0; c < cols; c++) {
-                for (int r = 0; r < rows; r++) {
-                    text += static_cast<char>(block[c][r].get());
-                }
-            }
+        if (rangeCount <= 1) {
+            cbcDecryptBlocks(blocks, count, keySchedule, engine, chainBlock);
+
+            return;
         }
 
-        if (removePKCS7PPadding) {
-            uint8_t padLength = static_cast<uint8_t>(text[text.length() - 1]);
-            bool validPad = true;
+        std::vector<size_t> rangeStarts(rangeCount + 1);
+        std::vector<Block<cols, rows>> rangeSeeds(rangeCount);
 
-            if (padLength > text.size()) {
-                validPad = false;
-            } else {
-                for (size_t i = text.size() - padLength; i < text.size(); i++) {
-                    if (static_cast<uint8_t>(text[i]) != padLength) {
-                        validPad = false;
+        for (size_t r = 0; r <= rangeCount; r++) {
+            rangeStarts[r] = count * r / rangeCount;
+        }
 
-                        break;
-                    }
-                }
-            }
+        for (size_t r = 0; r < rangeCount; r++) { // Each range chains from the ciphertext block before it, taken before any thread overwrites it
+            rangeSeeds[r] = r == 0 ? chainBlock : blocks[rangeStarts[r] - 1];
+        }
+
+        chainBlock = blocks[count - 1];
 
-            if (validPad) {
-                text.erase(text.end() - padLength, text.end());
+        pool.parallelFor(rangeCount, [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; r++) {
+                cbcDecryptBlocks(blocks + rangeStarts[r], rangeStarts[r + 1] - rangeStarts[r], keySchedule, engine, rangeSeeds[r]);
             }
-        }
+        });
+    }
+
+    template <size_t rounds> // Every block on its own, equal blocks give equal ciphertext. For building other modes on, not for protecting text
+    void ecbEncrypt(const KeySchedule<cols, rows, rounds>& keySchedule, const RoundEngine<rows>& engine, EngineBackend backend = EngineBackend::Auto) {
+        engine.encryptBlocks(blocks.data(), blocks.size(), keySchedule, backend);
+    }
+
+    template <size_t rounds>
+    void ecbDecrypt(const KeySchedule<cols, rows, rounds>& keySchedule, const RoundEngine<rows>& engine, EngineBackend backend = EngineBackend::Auto) {
+        engine.decryptBlocks(blocks.data(), blocks.size(), keySchedule, backend);
+    }
+
+    template <size_t rounds>
+    void cbcEncrypt(const KeySchedule<cols, rows, rounds>& keySchedule, const RoundEngine<rows>& engine, const Block<cols, rows>& ivBlock) {
+        Block<cols, rows> chainBlock = ivBlock;
+
+        cbcEncryptBlocks(blocks.data(), blocks.size(), keySchedule, engine, chainBlock);
+    }
+
+    template <size_t rounds>
+    void cbcDecrypt(const KeySchedule<cols, rows, rounds>& keySchedule, const RoundEngine<rows>& engine, const Block<cols, rows>& ivBlock) {
+        Block<cols, rows> chainBlock = ivBlock;
+
+        cbcDecryptBlocks(blocks.data(), blocks.size(), keySchedule, engine, chainBlock);
+    }
+
+    template <size_t rounds>
+    void cbcDecrypt(const KeySchedule<cols, rows, rounds>& keySchedule, const RoundEngine<rows>& engine, const Block<cols, rows>& ivBlock, ThreadPool& pool) {
+        Block<cols, rows> chainBlock = ivBlock;
+
+        cbcDecryptBlocks(blocks.data(), blocks.size(), keySchedule, engine, chainBlock, pool);
+    }
+
+    std::span<Block<cols, rows>> getBlocks() const {
+        return blocks;
+    }
+
+    std::span<std::byte> getBytes(bool removePKCS7Padding = false) const { // View of the blocks' bytes, nothing is copied
+        std::span<std::byte> bytes = std::as_writable_bytes(blocks);
+
+        return removePKCS7Padding ? bytes.first(unpaddedLength(bytes)) : bytes;
+    }
+
+    std::string getText(bool removePKCS7Padding = false) const {
+        std::span<std::byte> bytes = getBytes(removePKCS7Padding);
 
-        return text;
+        return std::string(reinterpret_cast<const char*>(bytes.data()), bytes.size());
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cstdlib>
+#include <cstddef>
+#include <utility>
+#include <stdexcept>
+
+#include "util.hpp"
+
+// Page aligned heap memory. Pages are the strictest alignment anything here needs (O_DIRECT), and wide vector loads
+// never straddle a cache line at the start of a buffer
+constexpr size_t pageAlignment = 4096;
+
+struct AlignedFree {
+    void operator()(std::byte* data) const {
+        std::free(data);
+    }
+};
+
+using AlignedBuffer = std::unique_ptr<std::byte[], AlignedFree>;
+
+inline AlignedBuffer allocateAligned(size_t size, size_t alignment = pageAlignment) {
+    size = (size + alignment - 1) / alignment * alignment; // aligned_alloc needs a multiple of the alignment
+    std::byte* data = static_cast<std::byte*>(std::aligned_alloc(alignment, size));
+
+    if (data == nullptr) throw std::bad_alloc();
+
+    return AlignedBuffer(data);
+}
+
+class BufferPool;
+
+// Buffer on loan from a BufferPool, handed back when destroyed. capacity() can exceed the size asked for
+class PooledBuffer {
+    BufferPool* pool = nullptr;
+    AlignedBuffer data;
+    size_t capacity = 0;
+
+    friend class BufferPool;
+
+    PooledBuffer(BufferPool* pool, AlignedBuffer data, size_t capacity) : pool(pool), data(std::move(data)), capacity(capacity) {}
+
+public:
+    PooledBuffer() = default;
+    PooledBuffer(PooledBuffer&& other) noexcept : pool(other.pool), data(std::move(other.data)), capacity(std::exchange(other.capacity, 0)) {}
+
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept {
+        if (this != &other) {
+            release();
+            pool = other.pool;
+            data = std::move(other.data);
+            capacity = std::exchange(other.capacity, 0);
+        }
+
+        return *this;
+    }
+
+    ~PooledBuffer() {
+        release();
+    }
+
+    void release();
+
+    std::byte* get() const {
+        return data.get();
+    }
+
+    char* chars() const {
+        return reinterpret_cast<char*>(data.get());
+    }
+
+    size_t size() const {
+        return capacity;
+    }
+};
+
+// Free lists of aligned buffers sized in whole pages. Work that repeats with similar sizes, such as encrypting one buffer or file
+// chunk after another, stops allocating once the first round has filled the lists. A request takes the smallest idle buffer that fits
+// unless it is more than an eighth too large, so a chunk plus its tag block costs one page more than the chunk instead of double
+class BufferPool {
+    static constexpr size_t maxIdleBytes = size_t(256) << 20; // Idle memory kept in total, larger bursts and larger buffers are freed again
+    static constexpr size_t maxSlackDivisor = 8;
+
+    std::mutex mutex;
+    std::multimap<size_t, AlignedBuffer> idle; // By capacity
+    size_t idleTotal = 0;
+
+    static size_t roundToPages(size_t size) {
+        return (std::max<size_t>(size, 1) + pageAlignment - 1) / pageAlignment * pageAlignment;
+    }
+
+    friend class PooledBuffer;
+
+    void giveBack(AlignedBuffer data, size_t capacity) { // Already wiped by the PooledBuffer, idle buffers never hold old plaintext or keystream
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (idleTotal + capacity > maxIdleBytes) return;
+
+        idle.emplace(capacity, std::move(data));
+        idleTotal += capacity;
+    }
+
+public:
+    BufferPool() = default;
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    PooledBuffer acquire(size_t size) {
+        size_t capacity = roundToPages(size);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = idle.lower_bound(capacity);
+
+            if (found != idle.end() && found->first <= capacity + capacity / maxSlackDivisor) {
+                size_t foundCapacity = found->first;
+                AlignedBuffer data = std::move(found->second);
+
+                idle.erase(found);
+                idleTotal -= foundCapacity;
+
+                return PooledBuffer(this, std::move(data), foundCapacity);
+            }
+        }
+
+        return PooledBuffer(this, allocateAligned(capacity), capacity); // Allocated outside the lock, other threads keep reusing meanwhile
+    }
+
+    void trim() { // Frees every idle buffer
+        std::lock_guard<std::mutex> lock(mutex);
+
+        idle.clear();
+        idleTotal = 0;
+    }
+
+    size_t idleBytes() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        return idleTotal;
+    }
+
+    static BufferPool& shared() { // Lives until exit, so buffers released from static destructors still have a pool to go to
+        static BufferPool* pool = new BufferPool();
+
+        return *pool;
+    }
+};
+
+inline void PooledBuffer::release() {
+    if (data) secureZero(data.get(), capacity); // Whether kept idle or freed, the next owner of this memory never sees what it held
+
+    if (pool != nullptr && data) pool->giveBack(std::move(data), capacity);
+
+    data.reset();
+    capacity = 0;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#include "block.hpp"
+#include "block_string.hpp"
+#include "key_schedule.hpp"
+#include "round_engine.hpp"
+#include "thread_pool.hpp"
+
+// CBC over data that arrives in pieces. The chaining block is carried between calls and PKCS#7 is only applied (or removed) in finish,
+// so memory use depends on the chunk size rather than the data size.
+template <size_t cols, size_t rows, size_t rounds>
+class CbcStream {
+    static constexpr size_t blockSize = cols * rows;
+
+    const KeySchedule<cols, rows, rounds>& keySchedule;
+    const RoundEngine<rows>& engine;
+    bool decrypting;
+
+    Block<cols, rows> chainBlock;
+    std::array<char, blockSize> pending; // Partial block, or when decrypting the latest full block which might turn out to hold the padding
+    size_t pendingLength = 0;
+
+    ThreadPool* pool; // Spreads decryption over several threads when set, encryption always chains serially
+
+    static constexpr size_t workBlockCount = 256;
+    static constexpr size_t minParallelBlocks = 4096; // Below this handing ranges to other threads costs more than it saves
+
+    void processRange(const char* input, size_t count, char* output, Block<cols, rows>& rangeChainBlock) const {
+        std::array<Block<cols, rows>, workBlockCount> workBlocks;
+
+        for (size_t start = 0; start < count; start += workBlockCount) {
+            size_t batch = std::min(workBlockCount, count - start);
+
+            std::memcpy(workBlocks.data(), input + start * blockSize, batch * blockSize); // Block<cols, rows> stores its bytes column by column, same as the text order
+
+            if (decrypting) BlockString<cols, rows>::cbcDecryptBlocks(workBlocks.data(), batch, keySchedule, engine, rangeChainBlock);
+            else BlockString<cols, rows>::cbcEncryptBlocks(workBlocks.data(), batch, keySchedule, engine, rangeChainBlock);
+
+            std::memcpy(output + start * blockSize, workBlocks.data(), batch * blockSize);
+        }
+    }
+
+    void processBlocks(const char* input, size_t count, char* output) {
+        if (!decrypting || pool == nullptr || count < minParallelBlocks) {
+            processRange(input, count, output, chainBlock);
+
+            return;
+        }
+
+        pool->parallelFor(count, [&](size_t begin, size_t end) { // The input is left untouched, so each range can read its seed ciphertext block straight from it
+            Block<cols, rows> rangeChainBlock = chainBlock;
+            if (begin > 0) std::memcpy(&rangeChainBlock, input + (begin - 1) * blockSize, blockSize);
+
+            processRange(input + begin * blockSize, end - begin, output + begin * blockSize, rangeChainBlock);
+        });
+
+        std::memcpy(&chainBlock, input + (count - 1) * blockSize, blockSize);
+    }
+
+public:
+    static_assert(sizeof(Block<cols, rows>) == blockSize, "Blocks must be stored as plain bytes to be copied in and out of the stream");
+
+    static constexpr size_t maxOverhead = blockSize; // Most bytes update or finish can write beyond the input given to them
+
+    CbcStream(const KeySchedule<cols, rows, rounds>& keySchedule, const RoundEngine<rows>& engine, const Block<cols, rows>& ivBlock, bool decrypting, ThreadPool* pool = nullptr)
+        : keySchedule(keySchedule), engine(engine), decrypting(decrypting), chainBlock(ivBlock), pending{}, pool(pool) {}
+
+    size_t update(const char* input, size_t length, char* output) { // Returns the number of bytes written, at most length + maxOverhead
+        size_t written = 0;
+
+        if (pendingLength > 0) {
+            size_t taken = std::min(blockSize - pendingLength, length);
+
+            std::memcpy(pending.data() + pendingLength, input, taken);
+            pendingLength += taken;
+            input += taken;
+            length -= taken;
+
+            if (pendingLength < blockSize || (decrypting && length == 0)) return 0;
+
+            processBlocks(pending.data(), 1, output);
+            pendingLength = 0;
+            written += blockSize;
+        }
+
+        size_t count = length / blockSize;
+        if (decrypting && count > 0 && length % blockSize == 0) count--; // Hold back the last block until finish knows whether more data follows
+
+        processBlocks(input, count, output + written);
+        written += count * blockSize;
+
+        pendingLength = length - count * blockSize;
+        std::memcpy(pending.data(), input + count * blockSize, pendingLength);
+
+        return written;
+    }
+
+    size_t finish(char* output) { // Pads and encrypts the remainder, or decrypts the final block and strips its padding
+        if (!decrypting) {
+            char padLength = static_cast<char>(blockSize - pendingLength);
+
+            std::fill(pending.begin() + pendingLength, pending.end(), padLength);
+            processBlocks(pending.data(), 1, output);
+            pendingLength = 0;
+
+            return blockSize;
+        }
+
+        if (pendingLength != blockSize) {
+            throw std::runtime_error("Encrypted data is not a whole number of blocks");
+        }
+
+        processBlocks(pending.data(), 1, output);
+        pendingLength = 0;
+
+        uint8_t padLength = static_cast<uint8_t>(output[blockSize - 1]);
+
+        if (padLength == 0 || padLength > blockSize) return blockSize; // Same leniency as BlockString::unpaddedLength, invalid padding is left in place
+
+        for (size_t i = blockSize - padLength; i < blockSize; i++) {
+            if (static_cast<uint8_t>(output[i]) != padLength) return blockSize;
+        }
+
+        return blockSize - padLength;
+    }
+};
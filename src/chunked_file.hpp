@@ -0,0 +1,637 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+#include "block.hpp"
+#include "cbc_stream.hpp"
+#include "ctr_stream.hpp"
+#include "gcm_stream.hpp"
+#include "file_header.hpp"
+#include "password_keys.hpp"
+#include "async_file_io.hpp"
+#include "mapped_file.hpp"
+#include "buffer_pool.hpp"
+#include "cipher_parameters.hpp"
+#include "cipher_variant.hpp"
+#include "thread_pool.hpp"
+#include "stats.hpp"
+
+// Chunked files (header version 3): the header, then the plaintext cut into chunks of the header's chunk size, each encrypted on its
+// own with an IV derived from the header IV and the chunk number, then an index of the chunks and a fixed size footer pointing at it.
+// Chunks decrypt in any order on any thread, and a byte range only needs the chunks covering it.
+//
+//   header | chunk 0 | chunk 1 | ... | chunk n-1 | index: n x (offset 8, cipher length 4, plain length 4) | footer: n 8, index offset 8, "DIYX", 4 reserved
+//
+// Every chunk but the last holds exactly a chunk size of plaintext. GCM chunks end in their own tag, authenticating the header, the chunk
+// number and whether it is the last one, so chunks can't be swapped, moved between files or dropped from the end. CBC chunks are each
+// padded, CTR chunks continue the file's keystream where the previous chunk ended.
+
+inline void writeBigEndian(char* output, uint64_t value, size_t length) {
+    for (size_t i = length; i-- > 0;) {
+        output[i] = static_cast<char>(value & 0xFF);
+        value >>= 8;
+    }
+}
+
+inline uint64_t readBigEndian(const char* input, size_t length) {
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        value = value << 8 | static_cast<uint8_t>(input[i]);
+    }
+
+    return value;
+}
+
+struct ChunkEntry {
+    static constexpr size_t encodedLength = 16;
+
+    uint64_t offset = 0; // Of the ciphertext in the file
+    uint32_t cipherLength = 0;
+    uint32_t plainLength = 0;
+
+    bool operator==(const ChunkEntry&) const = default;
+
+    void encode(char* output) const {
+        writeBigEndian(output, offset, 8);
+        writeBigEndian(output + 8, cipherLength, 4);
+        writeBigEndian(output + 12, plainLength, 4);
+    }
+
+    static ChunkEntry decode(const char* input) {
+        return {readBigEndian(input, 8), static_cast<uint32_t>(readBigEndian(input + 8, 4)), static_cast<uint32_t>(readBigEndian(input + 12, 4))};
+    }
+};
+
+struct ChunkFooter {
+    static constexpr std::array<char, 4> magic = {'D', 'I', 'Y', 'X'};
+    static constexpr size_t encodedLength = 24;
+
+    uint64_t chunkCount = 0;
+    uint64_t indexOffset = 0;
+
+    std::string serialize() const {
+        std::string bytes(encodedLength, '\0');
+
+        writeBigEndian(bytes.data(), chunkCount, 8);
+        writeBigEndian(bytes.data() + 8, indexOffset, 8);
+        std::copy(magic.begin(), magic.end(), bytes.begin() + 16);
+
+        return bytes;
+    }
+
+    static ChunkFooter parse(const char* bytes) {
+        if (!std::equal(magic.begin(), magic.end(), bytes + 16)) {
+            throw std::runtime_error("Chunked file has no index footer, it was cut short or is corrupt");
+        }
+
+        return {readBigEndian(bytes, 8), readBigEndian(bytes + 8, 8)};
+    }
+};
+
+// Where everything sits in a chunked file holding plainSize bytes. The index repeats this, readers check the two agree
+struct ChunkLayout {
+    size_t headerSize;
+    size_t chunkSize;
+    CipherMode mode;
+    uint64_t plainSize;
+
+    ChunkLayout(const FileHeader& header, uint64_t plainSize) : headerSize(header.size()), chunkSize(header.chunkSize()), mode(header.mode), plainSize(plainSize) {}
+
+    static size_t overhead(CipherMode mode) { // A GCM tag, or CBC padding of a whole chunk, both one block
+        return mode == CipherMode::CTR ? 0 : blockSize;
+    }
+
+    static size_t cipherLength(CipherMode mode, size_t plainLength) {
+        return mode == CipherMode::CBC ? plainLength - plainLength % blockSize + blockSize : plainLength + overhead(mode);
+    }
+
+    uint64_t chunkCount() const { // An empty file still has one chunk, so there is always a last chunk to authenticate
+        return std::max<uint64_t>(1, (plainSize + chunkSize - 1) / chunkSize);
+    }
+
+    ChunkEntry entry(uint64_t chunk) const {
+        uint64_t plainOffset = chunk * chunkSize;
+        uint32_t plainLength = static_cast<uint32_t>(std::min<uint64_t>(chunkSize, plainSize - plainOffset));
+
+        return {headerSize + chunk * (chunkSize + overhead(mode)), static_cast<uint32_t>(cipherLength(mode, plainLength)), plainLength};
+    }
+
+    uint64_t indexOffset() const {
+        ChunkEntry last = entry(chunkCount() - 1);
+
+        return last.offset + last.cipherLength;
+    }
+
+    uint64_t fileSize() const {
+        return indexOffset() + chunkCount() * ChunkEntry::encodedLength + ChunkFooter::encodedLength;
+    }
+
+    std::string serializeIndex() const { // Index followed by the footer
+        std::string bytes(chunkCount() * ChunkEntry::encodedLength, '\0');
+
+        for (uint64_t chunk = 0; chunk < chunkCount(); chunk++) {
+            entry(chunk).encode(bytes.data() + chunk * ChunkEntry::encodedLength);
+        }
+
+        return bytes + ChunkFooter{chunkCount(), indexOffset()}.serialize();
+    }
+
+    template <typename ReadAt>
+    static ChunkLayout load(const FileHeader& header, uint64_t fileSize, ReadAt&& readAt) { // Reads the footer and index through readAt(offset, length) and checks them
+        if (fileSize < header.size() + ChunkFooter::encodedLength) {
+            throw std::runtime_error("Chunked file is too short to hold its index");
+        }
+
+        ChunkFooter footer = ChunkFooter::parse(readAt(fileSize - ChunkFooter::encodedLength, ChunkFooter::encodedLength).data());
+        uint64_t indexLength = fileSize - ChunkFooter::encodedLength - footer.indexOffset;
+
+        if (footer.indexOffset > fileSize - ChunkFooter::encodedLength || footer.chunkCount == 0 || indexLength != footer.chunkCount * ChunkEntry::encodedLength) {
+            throw std::runtime_error("Corrupt chunk index");
+        }
+
+        std::string index = readAt(footer.indexOffset, indexLength);
+        ChunkEntry last = ChunkEntry::decode(index.data() + indexLength - ChunkEntry::encodedLength);
+        ChunkLayout layout(header, (footer.chunkCount - 1) * header.chunkSize() + last.plainLength);
+
+        bool consistent = layout.chunkCount() == footer.chunkCount && layout.fileSize() == fileSize;
+
+        for (uint64_t chunk = 0; consistent && chunk < footer.chunkCount; chunk++) {
+            consistent = ChunkEntry::decode(index.data() + chunk * ChunkEntry::encodedLength) == layout.entry(chunk);
+        }
+
+        if (!consistent) {
+            throw std::runtime_error("Corrupt chunk index, it does not match the chunk size in the header");
+        }
+
+        return layout;
+    }
+};
+
+// Encrypts and decrypts single chunks of one file under one cipher variant's schedule. Holds no per-chunk state, so any number of threads can share one
+template <size_t rounds>
+class ChunkCodec {
+    using Schedule = KeySchedule<cols, rows, rounds>;
+
+    const Schedule& keySchedule;
+    CipherMode mode;
+    std::string baseIv;
+    std::string headerBytes;
+    size_t chunkSize;
+
+    static_assert(GcmStream<cols, rows, rounds>::tagLength == blockSize, "Chunk overhead assumes the tag is one block");
+
+    std::string chunkIv(uint64_t chunk) const { // Chunk number added into the last 8 IV bytes. GCM IVs stay distinct, CBC ones are encrypted to be unpredictable
+        std::string iv = baseIv;
+        char number[8];
+
+        writeBigEndian(number, chunk, 8);
+
+        for (size_t i = 0; i < 8; i++) {
+            iv[iv.size() - 8 + i] ^= number[i];
+        }
+
+        if (mode == CipherMode::CBC) {
+            Block<cols, rows> ivBlock = Block<cols, rows>::fromString(iv);
+
+            roundEngine.encrypt(ivBlock, keySchedule);
+            std::memcpy(iv.data(), &ivBlock, blockSize);
+        }
+
+        return iv;
+    }
+
+    std::string authenticatedData(uint64_t chunk, bool last) const {
+        std::string data = headerBytes + std::string(9, '\0');
+
+        writeBigEndian(data.data() + headerBytes.size(), chunk, 8);
+        data.back() = last ? 1 : 0;
+
+        return data;
+    }
+
+public:
+    ChunkCodec(const FileHeader& header, const Schedule& keySchedule)
+        : keySchedule(keySchedule), mode(header.mode), baseIv(header.iv), headerBytes(header.authenticatedData()), chunkSize(header.chunkSize()) {
+        if (!header.isChunked() || baseIv.size() < 8) {
+            throw std::invalid_argument("Header does not describe a chunked file");
+        }
+    }
+
+    size_t encrypt(uint64_t chunk, bool last, const char* input, size_t length, char* output) const { // output needs room for ChunkLayout::cipherLength, returns the bytes written
+        if (mode == CipherMode::GCM) {
+            GcmStream<cols, rows, rounds> stream(keySchedule, roundEngine, chunkIv(chunk), false);
+            std::string aad = authenticatedData(chunk, last);
+
+            stream.addAuthenticatedData(aad.data(), aad.size());
+            stream.update(input, length, output);
+            stream.finish(output + length);
+            std::copy(stream.getTag().begin(), stream.getTag().end(), output + length);
+
+            return length + blockSize;
+        }
+
+        if (mode == CipherMode::CTR) {
+            CtrStream<cols, rows, rounds> stream(keySchedule, roundEngine, Block<cols, rows>::fromString(baseIv));
+
+            stream.seek(chunk * chunkSize);
+
+            return stream.update(input, length, output);
+        }
+
+        CbcStream<cols, rows, rounds> stream(keySchedule, roundEngine, Block<cols, rows>::fromString(chunkIv(chunk)), false);
+        size_t written = stream.update(input, length, output);
+
+        return written + stream.finish(output + written);
+    }
+
+    void decrypt(uint64_t chunk, bool last, const ChunkEntry& entry, const char* input, char* output) const { // Writes the entry's plainLength bytes, throws when the chunk fails authentication or holds a different length
+        size_t length = entry.cipherLength;
+        auto wrongLength = [&]() { return std::runtime_error("Chunk " + std::to_string(chunk) + " does not decrypt to the length in the index, the data or key is wrong"); };
+
+        if (length != ChunkLayout::cipherLength(mode, entry.plainLength)) throw wrongLength();
+
+        if (mode == CipherMode::GCM) {
+            GcmStream<cols, rows, rounds> stream(keySchedule, roundEngine, chunkIv(chunk), true);
+            std::string aad = authenticatedData(chunk, last);
+            typename GcmStream<cols, rows, rounds>::Tag tag;
+
+            std::copy_n(input + length - blockSize, blockSize, tag.begin());
+            stream.addAuthenticatedData(aad.data(), aad.size());
+            stream.setExpectedTag(tag);
+            stream.update(input, length - blockSize, output);
+            stream.finish(output);
+
+            return;
+        }
+
+        if (mode == CipherMode::CTR) {
+            CtrStream<cols, rows, rounds> stream(keySchedule, roundEngine, Block<cols, rows>::fromString(baseIv));
+
+            stream.seek(chunk * chunkSize);
+            stream.update(input, length, output);
+
+            return;
+        }
+
+        CbcStream<cols, rows, rounds> stream(keySchedule, roundEngine, Block<cols, rows>::fromString(chunkIv(chunk)), true);
+        std::array<char, blockSize> finalBlock; // finish writes the whole padding block, output only has room for the plaintext
+        size_t written = stream.update(input, length, output); // Everything but the padding block, which the length check above keeps within plainLength
+        size_t remaining = stream.finish(finalBlock.data());
+
+        if (written + remaining != entry.plainLength) throw wrongLength(); // Wrong padding, from a wrong key or changed data
+
+        std::copy_n(finalBlock.begin(), remaining, output + written);
+    }
+};
+
+template <typename Body>
+void forEachChunk(uint64_t chunkCount, ThreadPool* pool, Body&& body) { // body(begin, end) over contiguous chunk ranges, spread over the pool when there is one
+    if (pool == nullptr) body(uint64_t(0), chunkCount);
+    else pool->parallelFor(chunkCount, [&](size_t begin, size_t end) { body(uint64_t(begin), uint64_t(end)); });
+}
+
+struct FileSpan { // Where one chunk sits in the file it is read from or written to
+    uint64_t offset;
+    size_t length;
+};
+
+// Moves chunks [begin, end) from inFile to outFile through transform(chunk, input, output), inSpan and outSpan give each chunk's place in
+// the two files. Pipelined methods keep reads of the next chunks and writes of the previous ones in flight while the cipher runs, like
+// pipelineFile, the others read and write one chunk at a time. Spans in a direct file start on a sector, their lengths are rounded up
+// here and the caller truncates the padded output
+template <typename InSpan, typename OutSpan, typename Transform>
+void transferChunks(const IoFile& inFile, const IoFile& outFile, uint64_t begin, uint64_t end, size_t inCapacity, size_t outCapacity, const FileIoOptions& options,
+                    InSpan&& inSpan, OutSpan&& outSpan, Transform&& transform) {
+    if (begin == end) return;
+
+    if (!options.pipelined()) {
+        PooledBuffer input = BufferPool::shared().acquire(inCapacity);
+        PooledBuffer output = BufferPool::shared().acquire(outCapacity);
+
+        for (uint64_t chunk = begin; chunk < end; chunk++) {
+            FileSpan read = inSpan(chunk);
+            FileSpan write = outSpan(chunk);
+
+            StageTimer readTimer(Stage::Read, read.length);
+            inFile.readAt(input.chars(), read.length, read.offset);
+            readTimer.stop();
+
+            StageTimer cipherTimer(Stage::Cipher, read.length);
+            transform(chunk, input.chars(), output.chars());
+            cipherTimer.stop();
+
+            StageTimer writeTimer(Stage::Write, write.length);
+            outFile.writeAt(output.chars(), write.length, write.offset);
+        }
+
+        return;
+    }
+
+    size_t depth = static_cast<size_t>(std::min<uint64_t>(std::max<size_t>(options.queueDepth, 1), end - begin));
+
+    std::vector<PooledBuffer> inBuffers;
+    std::vector<PooledBuffer> outBuffers;
+
+    for (size_t i = 0; i < depth; i++) { // Whole pages, so lengths rounded up for direct I/O still fit
+        inBuffers.push_back(BufferPool::shared().acquire(inCapacity));
+        outBuffers.push_back(BufferPool::shared().acquire(outCapacity));
+    }
+
+    std::vector<IoRequest> reads(depth);
+    std::vector<IoRequest> writes(depth);
+    AsyncFileIo io(options.method, static_cast<unsigned>(2 * depth)); // Declared after the buffers and requests, so it finishes with them before they are freed
+
+    auto rounded = [](size_t length, const IoFile& file) {
+        return (length + file.alignment() - 1) / file.alignment() * file.alignment();
+    };
+
+    auto awaitRequest = [&](IoRequest& request) {
+        io.waitFor(request);
+
+        if (request.error != 0) {
+            throw std::ios_base::failure((request.write ? "Failed to write to file: " + outFile.getPath() : "Failed to read from file: " + inFile.getPath()) + " (" + std::strerror(request.error) + ")");
+        }
+    };
+
+    auto submitRead = [&](uint64_t chunk) {
+        FileSpan span = inSpan(chunk);
+        IoRequest& read = reads[(chunk - begin) % depth];
+
+        read.reset(inFile.get(), inBuffers[(chunk - begin) % depth].chars(), rounded(span.length, inFile), span.offset, span.length, false);
+        io.submit(read);
+    };
+
+    for (uint64_t chunk = begin; chunk < begin + depth; chunk++) {
+        submitRead(chunk);
+    }
+
+    for (uint64_t chunk = begin; chunk < end; chunk++) {
+        IoRequest& read = reads[(chunk - begin) % depth];
+        IoRequest& write = writes[(chunk - begin) % depth];
+        char* output = outBuffers[(chunk - begin) % depth].chars();
+
+        StageTimer readTimer(Stage::Read, read.wanted); // Only the time spent waiting, the read itself overlapped with earlier chunks
+        awaitRequest(read);
+        readTimer.stop();
+
+        if (read.transferred < read.wanted) {
+            throw std::runtime_error("File was truncated while reading: " + inFile.getPath());
+        }
+
+        StageTimer writeTimer(Stage::Write, write.complete ? 0 : write.wanted); // The output buffer's previous chunk has to be out first
+        awaitRequest(write);
+        writeTimer.stop();
+
+        StageTimer cipherTimer(Stage::Cipher, read.wanted);
+        transform(chunk, read.buffer, output);
+        cipherTimer.stop();
+
+        if (chunk + depth < end) submitRead(chunk + depth); // The input buffer was fully consumed by transform
+
+        FileSpan span = outSpan(chunk);
+        size_t padded = rounded(span.length, outFile);
+
+        std::memset(output + span.length, 0, padded - span.length);
+
+        if (padded > 0) { // An empty last chunk writes nothing, a zero length write would be taken for a failure
+            write.reset(outFile.get(), output, padded, span.offset, padded, true);
+            io.submit(write);
+        }
+    }
+
+    StageTimer writeTimer(Stage::Write);
+
+    for (IoRequest& write : writes) {
+        if (!write.complete) writeTimer.addBytes(write.wanted);
+
+        awaitRequest(write);
+    }
+}
+
+// Encrypts inPath into a new chunked file at outPath, chunks are spread over the pool and read and written at their own offsets through
+// io's method. Only the plaintext reads can be direct, the chunks land at offsets shifted by the header and the tags
+template <size_t rounds>
+void encryptChunkedFile(const std::string& inPath, const std::string& outPath, const FileHeader& header, const KeySchedule<cols, rows, rounds>& keySchedule, ThreadPool* pool, const FileIoOptions& io) {
+    ChunkCodec<rounds> codec(header, keySchedule);
+    std::string headerBytes = header.serialize();
+
+    if (io.method == IoMethod::Mmap) { // The codec works on the mapped pages directly, the output is sized exactly up front
+        MappedInputFile inFile(inPath);
+        ChunkLayout layout(header, inFile.size());
+        MappedOutputFile outFile(outPath, layout.fileSize());
+        std::string index = layout.serializeIndex();
+
+        std::copy(headerBytes.begin(), headerBytes.end(), outFile.getData());
+
+        forEachChunk(layout.chunkCount(), pool, [&](uint64_t begin, uint64_t end) {
+            for (uint64_t chunk = begin; chunk < end; chunk++) {
+                ChunkEntry entry = layout.entry(chunk);
+
+                StageTimer cipherTimer(Stage::Cipher, entry.plainLength); // Page faults on the mappings count here, reads and writes happen through them
+                codec.encrypt(chunk, chunk + 1 == layout.chunkCount(), inFile.getData() + chunk * layout.chunkSize, entry.plainLength, outFile.getData() + entry.offset);
+            }
+        });
+
+        std::copy(index.begin(), index.end(), outFile.getData() + layout.indexOffset());
+
+        StageTimer writeTimer(Stage::Write, layout.fileSize());
+        outFile.commit(layout.fileSize());
+
+        return;
+    }
+
+    IoFile inFile(inPath, false, io.directIo && io.pipelined());
+    IoFile outFile(outPath, true, false);
+
+    ChunkLayout layout(header, inFile.size());
+
+    outFile.writeAt(headerBytes.data(), headerBytes.size(), 0);
+
+    forEachChunk(layout.chunkCount(), pool, [&](uint64_t begin, uint64_t end) {
+        transferChunks(inFile, outFile, begin, end, layout.chunkSize, layout.chunkSize + blockSize, io,
+            [&](uint64_t chunk) { return FileSpan{chunk * layout.chunkSize, layout.entry(chunk).plainLength}; },
+            [&](uint64_t chunk) { ChunkEntry entry = layout.entry(chunk); return FileSpan{entry.offset, entry.cipherLength}; },
+            [&](uint64_t chunk, const char* input, char* output) { codec.encrypt(chunk, chunk + 1 == layout.chunkCount(), input, layout.entry(chunk).plainLength, output); });
+    });
+
+    std::string index = layout.serializeIndex();
+    outFile.writeAt(index.data(), index.size(), layout.indexOffset());
+
+    StageTimer syncTimer(Stage::Write);
+    outFile.sync();
+}
+
+// Random access to the plaintext of a chunked file, only the chunks covering a requested range are read and decrypted.
+// The header's cipher variant is resolved once on opening, each chunk then makes one indirect call into that variant's codec
+class ChunkedFileReader {
+    using ChunkDecryptor = std::function<void(uint64_t chunk, bool last, const ChunkEntry& entry, const char* input, char* output)>;
+
+    IoFile file;
+    FileHeader header;
+    ChunkDecryptor decryptor;
+    std::unique_ptr<ChunkLayout> layout;
+
+    std::string readAt(uint64_t offset, size_t length) const {
+        std::string bytes(length, '\0');
+        file.readAt(bytes.data(), length, offset);
+
+        return bytes;
+    }
+
+public:
+    ChunkedFileReader(const std::string& filePath, PasswordKeys& keys) : file(filePath, false, false) {
+        uint64_t fileSize = file.size();
+
+        header = FileHeader::parse(readAt(0, std::min<uint64_t>(fileSize, FileHeader::maxSize)));
+
+        if (!header.isChunked()) {
+            throw std::runtime_error("File is not chunked, it can only be decrypted as a whole: " + filePath);
+        }
+
+        layout = std::make_unique<ChunkLayout>(ChunkLayout::load(header, fileSize, [&](uint64_t offset, size_t length) { return readAt(offset, length); }));
+
+        decryptor = withCipherVariant(header.variant, [&](auto shape) -> ChunkDecryptor {
+            using Shape = decltype(shape);
+
+            std::shared_ptr<const typename Shape::Schedule> keySchedule = keys.get<Shape>(header.kdf); // Cached, processFile has already derived it when it hands a file over
+            auto codec = std::make_shared<const ChunkCodec<Shape::rounds>>(header, *keySchedule);
+
+            return [keySchedule, codec](uint64_t chunk, bool last, const ChunkEntry& entry, const char* input, char* output) { codec->decrypt(chunk, last, entry, input, output); };
+        });
+    }
+
+    const FileHeader& getHeader() const {
+        return header;
+    }
+
+    const ChunkLayout& getLayout() const {
+        return *layout;
+    }
+
+    uint64_t size() const { // Plaintext bytes
+        return layout->plainSize;
+    }
+
+    size_t decryptChunk(uint64_t chunk, char* cipherBuffer, char* output) const { // cipherBuffer needs room for a chunk and one block, output for a chunk
+        ChunkEntry entry = layout->entry(chunk);
+
+        StageTimer readTimer(Stage::Read, entry.cipherLength);
+        file.readAt(cipherBuffer, entry.cipherLength, entry.offset);
+        readTimer.stop();
+
+        StageTimer cipherTimer(Stage::Cipher, entry.plainLength);
+        decryptor(chunk, chunk + 1 == layout->chunkCount(), entry, cipherBuffer, output);
+
+        return entry.plainLength;
+    }
+
+    std::string read(uint64_t offset, size_t length) const {
+        if (offset > size()) offset = size();
+
+        length = static_cast<size_t>(std::min<uint64_t>(length, size() - offset));
+
+        std::string text(length, '\0');
+
+        if (length == 0) return text;
+
+        PooledBuffer cipherBuffer = BufferPool::shared().acquire(layout->chunkSize + blockSize);
+        PooledBuffer plainBuffer = BufferPool::shared().acquire(layout->chunkSize);
+
+        for (uint64_t chunk = offset / layout->chunkSize; chunk * layout->chunkSize < offset + length; chunk++) {
+            uint64_t chunkStart = chunk * layout->chunkSize;
+            size_t written = decryptChunk(chunk, cipherBuffer.chars(), plainBuffer.chars());
+
+            uint64_t from = std::max(offset, chunkStart);
+            uint64_t to = std::min(offset + length, chunkStart + written);
+
+            std::memcpy(text.data() + (from - offset), plainBuffer.chars() + (from - chunkStart), to - from);
+        }
+
+        return text;
+    }
+
+    void decryptTo(const std::string& outPath, ThreadPool* pool, const FileIoOptions& io) const { // Whole file, chunks spread over the pool. Only the plaintext writes can be direct
+        if (io.method == IoMethod::Mmap) {
+            MappedInputFile inFile(file.getPath());
+            MappedOutputFile outFile(outPath, size());
+
+            if (inFile.size() != layout->fileSize()) {
+                throw std::runtime_error("File changed size while decrypting: " + file.getPath());
+            }
+
+            forEachChunk(layout->chunkCount(), pool, [&](uint64_t begin, uint64_t end) {
+                for (uint64_t chunk = begin; chunk < end; chunk++) {
+                    ChunkEntry entry = layout->entry(chunk);
+
+                    StageTimer cipherTimer(Stage::Cipher, entry.plainLength);
+                    decryptor(chunk, chunk + 1 == layout->chunkCount(), entry, inFile.getData() + entry.offset, outFile.getData() + chunk * layout->chunkSize);
+                }
+            });
+
+            StageTimer writeTimer(Stage::Write, size());
+            outFile.commit(size());
+
+            return;
+        }
+
+        IoFile outFile(outPath, true, io.directIo && io.pipelined());
+
+        forEachChunk(layout->chunkCount(), pool, [&](uint64_t begin, uint64_t end) {
+            transferChunks(file, outFile, begin, end, layout->chunkSize + blockSize, layout->chunkSize, io,
+                [&](uint64_t chunk) { ChunkEntry entry = layout->entry(chunk); return FileSpan{entry.offset, entry.cipherLength}; },
+                [&](uint64_t chunk) { return FileSpan{chunk * layout->chunkSize, layout->entry(chunk).plainLength}; },
+                [&](uint64_t chunk, const char* input, char* output) { decryptor(chunk, chunk + 1 == layout->chunkCount(), layout->entry(chunk), input, output); });
+        });
+
+        outFile.truncate(size()); // Sets the length even when the last chunk is empty, and trims the padding of a direct last write
+
+        StageTimer syncTimer(Stage::Write);
+        outFile.sync();
+    }
+};
+
+// In memory counterparts for the daemon, taking and producing the same bytes as a chunked file
+template <size_t rounds>
+std::string encryptChunkedData(const char* data, size_t length, const FileHeader& header, const KeySchedule<cols, rows, rounds>& keySchedule, size_t prefixSpace = 0) {
+    ChunkLayout layout(header, length);
+    ChunkCodec<rounds> codec(header, keySchedule);
+    std::string headerBytes = header.serialize();
+    std::string index = layout.serializeIndex();
+
+    std::string output(prefixSpace + layout.fileSize(), '\0');
+    std::copy(headerBytes.begin(), headerBytes.end(), output.begin() + prefixSpace);
+
+    for (uint64_t chunk = 0; chunk < layout.chunkCount(); chunk++) {
+        ChunkEntry entry = layout.entry(chunk);
+
+        codec.encrypt(chunk, chunk + 1 == layout.chunkCount(), data + chunk * layout.chunkSize, entry.plainLength, output.data() + prefixSpace + entry.offset);
+    }
+
+    std::copy(index.begin(), index.end(), output.begin() + prefixSpace + layout.indexOffset());
+
+    return output;
+}
+
+template <size_t rounds>
+std::string decryptChunkedData(const char* data, size_t length, const FileHeader& header, const KeySchedule<cols, rows, rounds>& keySchedule, size_t prefixSpace = 0) {
+    ChunkLayout layout = ChunkLayout::load(header, length, [&](uint64_t offset, size_t count) { return std::string(data + offset, count); });
+    ChunkCodec<rounds> codec(header, keySchedule);
+
+    std::string output(prefixSpace + layout.plainSize, '\0');
+
+    for (uint64_t chunk = 0; chunk < layout.chunkCount(); chunk++) {
+        ChunkEntry entry = layout.entry(chunk);
+        codec.decrypt(chunk, chunk + 1 == layout.chunkCount(), entry, data + entry.offset, output.data() + prefixSpace + chunk * layout.chunkSize);
+    }
+
+    return output;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+
+#include "gf256.hpp"
+#include "vector.hpp"
+#include "matrix.hpp"
+#include "substitution_box.hpp"
+#include "round_engine.hpp"
+#include "key_schedule.hpp"
+
+constexpr size_t cols = 4;
+constexpr size_t rows = 4;
+constexpr size_t blockSize = cols * rows;
+
+constexpr size_t keyWordCount = 4; // Default key of 4 words (AES-128), files can pick 6 or 8 at run time through cipher_variant.hpp
+constexpr size_t keySize = keyWordCount * rows;
+
+constexpr size_t rounds = std::max(cols, keyWordCount) + 6; // Rijndael's rule, 10, 12 or 14 for 128-bit blocks
+
+template <size_t count>
+constexpr std::array<GF256, count> makeRoundConstants() { // Successive powers of x, 01 02 04 ... 80 1B 36 for AES
+    std::array<GF256, count> constants{};
+    GF256 constant = 1;
+
+    for (int i = 0; i < count; i++) {
+        constants[i] = constant;
+        constant *= 2;
+    }
+
+    return constants;
+}
+
+constexpr std::array<GF256, roundConstantCount(cols, keyWordCount, rounds)> roundConstants = makeRoundConstants<roundConstantCount(cols, keyWordCount, rounds)>();
+
+constexpr SubstitutionBox subBox;
+
+constexpr Matrix<rows> mixColMatrix = Matrix<rows>::createCirculantMatrix(Vector<rows>({2, 3, 1, 1}));
+constexpr Matrix<rows> mixColMatrixInv = mixColMatrix.inverse();
+
+constexpr RoundEngine<rows> roundEngine(subBox, mixColMatrix, mixColMatrixInv);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+#include "key_schedule.hpp"
+#include "cipher_parameters.hpp"
+
+// Key sizes chosen at run time. Every variant is its own set of template instantiations (schedule, streams, engine paths), and
+// withCipherVariant picks one once per file or message, so nothing inside the cipher loops branches or calls through a pointer on it.
+// Blocks stay 128 bits wide here, GCM and the hardware AES paths are only defined for those.
+enum class CipherVariant : uint8_t {
+    Aes128 = 0,
+    Aes192 = 1,
+    Aes256 = 2
+};
+
+template <size_t variantKeyWordCount>
+struct CipherShape {
+    static constexpr size_t keyWordCount = variantKeyWordCount;
+    static constexpr size_t keySize = keyWordCount * rows;
+    static constexpr size_t rounds = std::max(cols, keyWordCount) + 6;
+    static constexpr std::array<GF256, roundConstantCount(cols, keyWordCount, rounds)> roundConstants = makeRoundConstants<roundConstantCount(cols, keyWordCount, rounds)>();
+
+    using Schedule = KeySchedule<cols, rows, rounds>;
+};
+
+using DefaultCipherShape = CipherShape<keyWordCount>;
+
+template <typename Body>
+decltype(auto) withCipherVariant(CipherVariant variant, Body&& body) { // Calls body with the CipherShape of the variant
+    switch (variant) {
+        case CipherVariant::Aes128: return body(CipherShape<4>{});
+        case CipherVariant::Aes192: return body(CipherShape<6>{});
+        case CipherVariant::Aes256: return body(CipherShape<8>{});
+        default: throw std::invalid_argument("Unknown cipher variant enum value");
+    }
+}
+
+inline size_t variantKeySize(CipherVariant variant) {
+    return withCipherVariant(variant, [](auto shape) { return decltype(shape)::keySize; });
+}
+
+inline CipherVariant variantForKeyBits(size_t bits) {
+    if (bits == 128) return CipherVariant::Aes128;
+    if (bits == 192) return CipherVariant::Aes192;
+    if (bits == 256) return CipherVariant::Aes256;
+
+    throw std::invalid_argument("Key size must be 128, 192 or 256 bits");
+}
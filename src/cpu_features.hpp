@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_X86 1
+#else
+#define CPU_X86 0
+#endif
+
+#if CPU_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define CPU_TARGET(isa) __attribute__((target(isa))) // Lets a single function use instructions beyond the baseline the file was compiled for
+#else
+#define CPU_TARGET(isa)
+#endif
+
+#if defined(CPU_MULTIVERSION) && CPU_X86 && defined(__GNUC__) && defined(__ELF__)
+#define CPU_CLONES __attribute__((target_clones("default", "sse4.1", "avx2", "arch=x86-64-v4"))) // Compiles plain loops once per level, the loader picks one for the running CPU
+#else
+#define CPU_CLONES
+#endif
+
+class CpuFeatures {
+    bool ssse3 = false;
+    bool avx2 = false;
+    bool aes = false;
+    bool pclmul = false;
+    bool sse41 = false;
+    bool sha = false;
+    bool avx512 = false; // Foundation and byte/word instructions, with the OS saving ZMM state
+    bool vaes = false;
+
+    static CpuFeatures detect() {
+        CpuFeatures features;
+
+#if CPU_X86
+        uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+        cpuid(0, eax, ebx, ecx, edx);
+        uint32_t maxLeaf = eax;
+
+        cpuid(1, eax, ebx, ecx, edx);
+
+        features.ssse3 = ecx & (1 << 9);
+        features.aes = ecx & (1 << 25);
+        features.pclmul = ecx & (1 << 1);
+        features.sse41 = ecx & (1 << 19);
+
+        bool osSavesYmm = (ecx & (1 << 27)) && (ecx & (1 << 28)) && (xgetbv() & 0b110) == 0b110; // OSXSAVE and AVX, plus the OS actually saving XMM/YMM state
+        bool osSavesZmm = osSavesYmm && (xgetbv() & 0b11100000) == 0b11100000; // Opmask registers and both halves of the ZMM state
+
+        if (maxLeaf >= 7) {
+            cpuid(7, eax, ebx, ecx, edx);
+
+            features.avx2 = osSavesYmm && (ebx & (1 << 5));
+            features.sha = ebx & (1 << 29);
+            features.avx512 = osSavesZmm && (ebx & (1 << 16)) && (ebx & (1 << 30));
+            features.vaes = osSavesYmm && (ecx & (1 << 9));
+        }
+#endif
+
+        return features;
+    }
+
+#if CPU_X86
+    static void cpuid(uint32_t leaf, uint32_t& eax, uint32_t& ebx, uint32_t& ecx, uint32_t& edx) {
+#if defined(_MSC_VER)
+        int registers[4];
+        __cpuidex(registers, leaf, 0);
+
+        eax = registers[0];
+        ebx = registers[1];
+        ecx = registers[2];
+        edx = registers[3];
+#else
+        __cpuid_count(leaf, 0, eax, ebx, ecx, edx);
+#endif
+    }
+
+    static uint64_t xgetbv() {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        uint32_t low, high;
+        __asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+
+        return (static_cast<uint64_t>(high) << 32) | low;
+#endif
+    }
+#endif
+
+public:
+    static const CpuFeatures& get() { // Detected once, cpuid is far too slow to query per call
+        static const CpuFeatures features = detect();
+
+        return features;
+    }
+
+    bool hasSSSE3() const {
+        return ssse3;
+    }
+
+    bool hasAVX2() const {
+        return avx2;
+    }
+
+    bool hasAES() const {
+        return aes;
+    }
+
+    bool hasPCLMUL() const {
+        return pclmul;
+    }
+
+    bool hasSSE41() const {
+        return sse41;
+    }
+
+    bool hasSHA() const {
+        return sha;
+    }
+
+    bool hasAVX512() const {
+        return avx512;
+    }
+
+    bool hasVAES() const {
+        return vaes;
+    }
+};
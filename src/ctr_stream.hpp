@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <algorithm>
+
+#include "block.hpp"
+#include "key_schedule.hpp"
+#include "round_engine.hpp"
+#include "thread_pool.hpp"
+#include "util.hpp"
+
+// Counter mode, the keystream block for block index i is the IV plus i (as one big endian number) run through the cipher.
+// Encryption and decryption are the same operation, no padding is needed, and any byte offset can be reached directly with seek.
+template <size_t cols, size_t rows, size_t rounds>
+class CtrStream {
+    static constexpr size_t blockSize = cols * rows;
+
+    const KeySchedule<cols, rows, rounds>& keySchedule;
+    const RoundEngine<rows>& engine;
+    Block<cols, rows> ivBlock;
+    uint64_t position = 0; // Byte offset into the keystream of the next update
+
+    ThreadPool* pool;
+
+    static constexpr size_t workBlockCount = 256; // Counter blocks handed to the engine at once
+    static constexpr size_t minParallelBlocks = 4096;
+
+    static void addToCounter(Block<cols, rows>& counter, uint64_t value) {
+        unsigned carry = 0;
+
+        for (size_t i = blockSize; i-- > 0 && (value > 0 || carry > 0);) { // Text order byte i sits at column i / rows, row i % rows
+            GF256& byte = counter[i / rows][i % rows];
+            unsigned sum = byte.get() + static_cast<unsigned>(value & 0xFF) + carry;
+
+            byte = static_cast<uint8_t>(sum);
+            carry = sum >> 8;
+            value >>= 8;
+        }
+    }
+
+    void applyKeystream(const char* input, size_t length, char* output, uint64_t offset) const {
+        std::array<Block<cols, rows>, workBlockCount> keystream;
+
+        for (size_t done = 0; done < length;) {
+            uint64_t blockIndex = (offset + done) / blockSize;
+            size_t skip = (offset + done) % blockSize;
+            size_t batch = std::min(workBlockCount, (skip + length - done + blockSize - 1) / blockSize);
+
+            Block<cols, rows> counter = ivBlock;
+            addToCounter(counter, blockIndex);
+
+            engine.encryptCounters(keystream.data(), batch, counter, keySchedule);
+
+            const char* keystreamBytes = reinterpret_cast<const char*>(keystream.data()) + skip;
+            size_t taken = std::min(batch * blockSize - skip, length - done);
+
+            xorBytes(input + done, keystreamBytes, output + done, taken);
+
+            done += taken;
+        }
+    }
+
+public:
+    static_assert(sizeof(Block<cols, rows>) == blockSize, "Blocks must be stored as plain bytes to be used as keystream");
+
+    static constexpr size_t maxOverhead = 0;
+
+    CtrStream(const KeySchedule<cols, rows, rounds>& keySchedule, const RoundEngine<rows>& engine, const Block<cols, rows>& ivBlock, ThreadPool* pool = nullptr)
+        : keySchedule(keySchedule), engine(engine), ivBlock(ivBlock), pool(pool) {}
+
+    void seek(uint64_t offset) { // Decrypting a byte range only needs the keystream from its own blocks
+        position = offset;
+    }
+
+    uint64_t tell() const {
+        return position;
+    }
+
+    size_t update(const char* input, size_t length, char* output) { // Always writes exactly length bytes, input and output may be the same buffer
+        size_t blockCount = (length + blockSize - 1) / blockSize;
+
+        if (pool == nullptr || blockCount < minParallelBlocks) {
+            applyKeystream(input, length, output, position);
+        } else {
+            pool->parallelFor(blockCount, [&](size_t begin, size_t end) { // Counter ranges are independent, each thread starts from its own block index
+                size_t byteBegin = begin * blockSize;
+                size_t byteEnd = std::min(end * blockSize, length);
+
+                applyKeystream(input + byteBegin, byteEnd - byteBegin, output + byteBegin, position + byteBegin);
+            });
+        }
+
+        position += length;
+
+        return length;
+    }
+
+    size_t finish(char*) { // Nothing is buffered, the parameter only matches the other streams
+        return 0;
+    }
+};
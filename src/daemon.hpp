@@ -0,0 +1,446 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "file_crypt.hpp"
+#include "file_header.hpp"
+#include "password_keys.hpp"
+#include "thread_pool.hpp"
+
+#if defined(__linux__)
+#define DAEMON_SUPPORTED 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#else
+#define DAEMON_SUPPORTED 0
+#endif
+
+// Serves encrypt and decrypt requests over a Unix domain socket, so many small payloads skip process startup, the password
+// prompt and key derivation. One thread runs an epoll loop over every connection, a worker pool does the cipher work.
+//
+// Every message is a frame: a 4 byte big endian length, then that many bytes.
+//   Request:  operation (1 encrypt, 2 decrypt), mode (0 CBC, 1 CTR, 2 GCM, ignored when decrypting), payload
+//   Response: status (0 ok, 1 error), then the result or an error message
+// Encrypted payloads use the encrypted file layout, header included, so they can be written out as .enc files and back. They are
+// chunked with the daemon's --chunk-size and --key-size, like files from the same command line would be.
+// Requests on one connection are answered in order, one at a time, so clients wanting parallelism open more connections.
+class EncryptionDaemon {
+public:
+    enum class Operation : uint8_t {
+        Encrypt = 1,
+        Decrypt = 2
+    };
+
+    enum class Status : uint8_t {
+        Ok = 0,
+        Error = 1
+    };
+
+    static constexpr size_t lengthSize = 4;
+    static constexpr size_t requestHeaderSize = 2; // Operation and mode
+    static constexpr size_t responseHeaderSize = lengthSize + 1;
+    static constexpr int acceptRetryMs = 100; // How long accepting stays paused when no connection of ours closes to free a descriptor
+    static constexpr size_t maxFrameLength = size_t(256) << 20; // Anything longer is treated as a broken client, the connection is dropped
+
+#if DAEMON_SUPPORTED
+private:
+    struct Connection {
+        uint64_t id;
+        uint8_t lengthBytes[lengthSize];
+        size_t lengthFilled = 0;
+        std::string frame; // Sized from the length prefix, the socket is read straight into it
+        size_t frameFilled = 0;
+        std::string response; // Built by a worker with its frame header in front, sent as is
+        size_t responseSent = 0;
+        bool busy = false; // A worker has this connection's request, reading pauses until the answer is sent
+    };
+
+    struct Completion {
+        int fd;
+        uint64_t connectionId;
+        std::string response;
+    };
+
+    std::string socketPath;
+    PasswordKeys& keys;
+    EncryptionOptions encryption;
+    size_t workerCount;
+    std::unique_ptr<ThreadPool> pool; // Started in run, after the signals are blocked, so workers inherit the mask
+
+    int listenFd = -1;
+    bool accepting = true; // Whether listenFd is in the epoll set, it is taken out while the process has no descriptors left
+    int epollFd = -1;
+    int wakeFd = -1; // Workers write it after queueing a completion, the loop then collects the responses
+    int signalFd = -1;
+
+    std::unordered_map<int, Connection> connections;
+    uint64_t nextConnectionId = 0;
+
+    std::mutex completionMutex;
+    std::vector<Completion> completions;
+
+    [[noreturn]] static void fail(const std::string& message) {
+        throw std::runtime_error(message + " (" + std::strerror(errno) + ")");
+    }
+
+    static void storeLength(char* bytes, uint32_t length) {
+        for (int i = 0; i < 4; i++) bytes[i] = static_cast<char>(length >> (24 - i * 8));
+    }
+
+    static uint32_t loadLength(const uint8_t* bytes) {
+        return static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16 | static_cast<uint32_t>(bytes[2]) << 8 | bytes[3];
+    }
+
+    void watch(int fd, uint32_t events, int operation = EPOLL_CTL_MOD) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+
+        if (epoll_ctl(epollFd, operation, fd, &event) != 0) fail("Failed to watch socket");
+    }
+
+    void openSocket() {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+
+        if (socketPath.size() >= sizeof(address.sun_path)) {
+            throw std::invalid_argument("Socket path is too long: " + socketPath);
+        }
+
+        std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+        struct stat info;
+
+        if (lstat(socketPath.c_str(), &info) == 0) { // Left over from a daemon that didn't shut down cleanly, unless one still answers on it
+            if (!S_ISSOCK(info.st_mode)) throw std::runtime_error("Path exists and is not a socket: " + socketPath);
+
+            int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            bool alive = probe >= 0 && connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+
+            if (probe >= 0) close(probe);
+            if (alive) throw std::runtime_error("A daemon is already listening on " + socketPath);
+
+            unlink(socketPath.c_str());
+        }
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+        if (listenFd < 0) fail("Failed to create socket");
+
+        mode_t previousMask = umask(0077); // Only the owner may connect, anyone connected can use the key
+        int bound = bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        umask(previousMask);
+
+        if (bound != 0) fail("Failed to bind " + socketPath);
+        if (listen(listenFd, SOMAXCONN) != 0) fail("Failed to listen on " + socketPath);
+    }
+
+    void acceptConnections() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            if (fd < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED) return;
+                if (errno == EMFILE || errno == ENFILE) { // Out of descriptors, the rest wait in the backlog. The socket stays readable, so it leaves the epoll set until some close or the retry interval passes
+                    epoll_ctl(epollFd, EPOLL_CTL_DEL, listenFd, nullptr);
+                    accepting = false;
+
+                    return;
+                }
+
+                fail("Failed to accept connection");
+            }
+
+            Connection& connection = connections[fd];
+            connection = Connection{};
+            connection.id = nextConnectionId++;
+
+            watch(fd, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+        }
+    }
+
+    void resumeAccepting() {
+        if (accepting) return;
+
+        watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+        accepting = true;
+    }
+
+    void closeConnection(int fd) { // A worker still holding its request finishes, its response is dropped by the id check
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections.erase(fd);
+        resumeAccepting();
+    }
+
+    bool readRequest(int fd, Connection& connection) { // Reads until a whole frame is in or the socket is drained, false once the connection is gone
+        while (!connection.busy) {
+            char* target;
+            size_t wanted;
+
+            if (connection.lengthFilled < lengthSize) {
+                target = reinterpret_cast<char*>(connection.lengthBytes) + connection.lengthFilled;
+                wanted = lengthSize - connection.lengthFilled;
+            } else {
+                target = connection.frame.data() + connection.frameFilled;
+                wanted = connection.frame.size() - connection.frameFilled;
+            }
+
+            ssize_t received = recv(fd, target, wanted, 0);
+
+            if (received < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+                if (errno == EINTR) continue;
+
+                return false;
+            }
+
+            if (received == 0) return false; // Peer closed, a half sent request is dropped
+
+            if (connection.lengthFilled < lengthSize) {
+                connection.lengthFilled += received;
+
+                if (connection.lengthFilled < lengthSize) continue;
+
+                uint32_t length = loadLength(connection.lengthBytes);
+
+                if (length < requestHeaderSize || length > maxFrameLength) return false;
+
+                connection.frame.assign(length, '\0');
+                connection.frameFilled = 0;
+            } else {
+                connection.frameFilled += received;
+            }
+
+            if (connection.frameFilled == connection.frame.size()) {
+                dispatch(fd, connection);
+            }
+        }
+
+        return true;
+    }
+
+    void dispatch(int fd, Connection& connection) {
+        connection.busy = true;
+        watch(fd, 0); // Nothing to wait for until the response is ready, hang ups and errors are still reported
+
+        auto request = std::make_shared<std::string>(std::move(connection.frame));
+        uint64_t connectionId = connection.id;
+
+        connection.frame.clear();
+        connection.lengthFilled = 0;
+
+        pool->submit([this, fd, connectionId, request]() {
+            std::string response = handle(*request);
+
+            {
+                std::lock_guard<std::mutex> lock(completionMutex);
+                completions.push_back({fd, connectionId, std::move(response)});
+            }
+
+            uint64_t one = 1;
+            ssize_t ignored = write(wakeFd, &one, sizeof(one));
+            (void)ignored;
+        });
+    }
+
+    std::string handle(const std::string& request) { // Runs on a worker, returns a whole response frame
+        std::string response;
+        Status status = Status::Ok;
+
+        try {
+            Operation operation = static_cast<Operation>(request[0]);
+            uint8_t modeValue = static_cast<uint8_t>(request[1]);
+            const char* payload = request.data() + requestHeaderSize;
+            size_t payloadLength = request.size() - requestHeaderSize;
+
+            if (operation == Operation::Encrypt) {
+                if (modeValue > static_cast<uint8_t>(CipherMode::GCM)) throw std::invalid_argument("Unknown mode " + std::to_string(modeValue));
+
+                EncryptionOptions options = encryption; // The chunk size and key size are the daemon's, the mode is the request's
+                options.mode = static_cast<CipherMode>(modeValue);
+
+                response = encryptData(payload, payloadLength, keys, options, responseHeaderSize);
+            } else if (operation == Operation::Decrypt) {
+                response = decryptData(payload, payloadLength, keys, responseHeaderSize);
+            } else {
+                throw std::invalid_argument("Unknown operation " + std::to_string(request[0]));
+            }
+        } catch (const std::exception& error) {
+            status = Status::Error;
+            response = std::string(responseHeaderSize, '\0') + error.what();
+        }
+
+        storeLength(response.data(), static_cast<uint32_t>(response.size() - lengthSize));
+        response[lengthSize] = static_cast<char>(status);
+
+        return response;
+    }
+
+    void collectCompletions() {
+        uint64_t count;
+        ssize_t ignored = read(wakeFd, &count, sizeof(count));
+        (void)ignored;
+
+        std::vector<Completion> ready;
+
+        {
+            std::lock_guard<std::mutex> lock(completionMutex);
+            ready.swap(completions);
+        }
+
+        for (Completion& completion : ready) {
+            auto found = connections.find(completion.fd);
+
+            if (found == connections.end() || found->second.id != completion.connectionId) continue; // Closed while the worker ran
+
+            found->second.response = std::move(completion.response);
+            found->second.responseSent = 0;
+
+            if (!sendResponse(completion.fd, found->second)) closeConnection(completion.fd);
+        }
+    }
+
+    bool sendResponse(int fd, Connection& connection) { // Sends what the socket takes, false once the connection is gone
+        while (connection.responseSent < connection.response.size()) {
+            ssize_t sent = send(fd, connection.response.data() + connection.responseSent, connection.response.size() - connection.responseSent, MSG_NOSIGNAL);
+
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    watch(fd, EPOLLOUT);
+
+                    return true;
+                }
+
+                if (errno == EINTR) continue;
+
+                return false;
+            }
+
+            connection.responseSent += sent;
+        }
+
+        connection.response = std::string(); // Releases the buffer, responses can be large
+        connection.busy = false;
+        watch(fd, EPOLLIN | EPOLLRDHUP);
+
+        return readRequest(fd, connection); // The client may have pipelined its next request
+    }
+
+    void handleConnection(int fd, uint32_t events) {
+        auto found = connections.find(fd);
+
+        if (found == connections.end()) return;
+
+        Connection& connection = found->second;
+        bool open = !(events & (EPOLLERR | EPOLLHUP)); // Either side fully gone, a half closed peer may still read its answer
+
+        if (open && (events & EPOLLOUT)) open = sendResponse(fd, connection);
+        if (open && !connection.busy && (events & (EPOLLIN | EPOLLRDHUP))) open = readRequest(fd, connection);
+
+        if (!open) closeConnection(fd);
+    }
+
+    void release() {
+        for (auto& [fd, connection] : connections) close(fd);
+        connections.clear();
+
+        if (listenFd >= 0) {
+            close(listenFd);
+            unlink(socketPath.c_str());
+        }
+
+        if (epollFd >= 0) close(epollFd);
+        if (wakeFd >= 0) close(wakeFd);
+        if (signalFd >= 0) close(signalFd);
+
+        listenFd = epollFd = wakeFd = signalFd = -1;
+    }
+
+public:
+    EncryptionDaemon(std::string socketPath, PasswordKeys& keys, const EncryptionOptions& encryption, size_t workerCount)
+        : socketPath(socketPath), keys(keys), encryption(encryption), workerCount(workerCount) {}
+
+    EncryptionDaemon(const EncryptionDaemon&) = delete;
+    EncryptionDaemon& operator=(const EncryptionDaemon&) = delete;
+
+    ~EncryptionDaemon() {
+        pool.reset(); // Workers finish their requests before the descriptors they report to are closed
+        release();
+    }
+
+    void run() { // Serves until SIGINT or SIGTERM, then removes the socket
+        sigset_t stopSignals;
+        sigemptyset(&stopSignals);
+        sigaddset(&stopSignals, SIGINT);
+        sigaddset(&stopSignals, SIGTERM);
+
+        if (pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr) != 0) fail("Failed to block signals");
+
+        pool = std::make_unique<ThreadPool>(workerCount + 1); // The pool counts the calling thread, which here runs the event loop instead
+
+        openSocket();
+
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        signalFd = signalfd(-1, &stopSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+        if (epollFd < 0 || wakeFd < 0 || signalFd < 0) fail("Failed to set up event loop");
+
+        watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+        watch(wakeFd, EPOLLIN, EPOLL_CTL_ADD);
+        watch(signalFd, EPOLLIN, EPOLL_CTL_ADD);
+
+        std::vector<epoll_event> events(64);
+
+        while (true) {
+            int count = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), accepting ? -1 : acceptRetryMs);
+
+            if (count == 0) resumeAccepting(); // Descriptors may have been freed elsewhere in the process or system
+
+            if (count < 0) {
+                if (errno == EINTR) continue;
+
+                fail("Event loop failed");
+            }
+
+            for (int i = 0; i < count; i++) {
+                int fd = events[i].data.fd;
+
+                if (fd == signalFd) {
+                    pool.reset();
+                    release();
+
+                    return;
+                }
+
+                if (fd == listenFd) acceptConnections();
+                else if (fd == wakeFd) collectCompletions();
+                else handleConnection(fd, events[i].events);
+            }
+        }
+    }
+#else
+public:
+    EncryptionDaemon(std::string socketPath, PasswordKeys& keys, const EncryptionOptions& encryption, size_t workerCount) {}
+
+    void run() {
+        throw std::runtime_error("Daemon mode is only supported on Linux");
+    }
+#endif
+};
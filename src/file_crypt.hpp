@@ -0,0 +1,587 @@
+#pragma once
+
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <bit>
+
+#include "block.hpp"
+#include "cbc_stream.hpp"
+#include "ctr_stream.hpp"
+#include "gcm_stream.hpp"
+#include "file_header.hpp"
+#include "mapped_file.hpp"
+#include "async_file_io.hpp"
+#include "chunked_file.hpp"
+#include "key_schedule.hpp"
+#include "password_keys.hpp"
+#include "cipher_parameters.hpp"
+#include "cipher_variant.hpp"
+#include "secure_random.hpp"
+#include "thread_pool.hpp"
+#include "stats.hpp"
+
+// Encrypting and decrypting whole files in place, shared by the command line tool and the benchmarks
+
+inline const std::string encryptedExtension = ".enc";
+inline const std::string ivExtension = ".iv";
+inline const std::string tempExtension = ".tmp";
+
+constexpr size_t streamChunkSize = 1 << 20; // Bytes read per chunk, memory use stays around twice this (twice the queue depth for the pipeline) no matter the file size
+
+inline std::string generateIV(size_t length) { // Also used for salts, from the calling thread's generator
+    return SecureRandom::local().bytes(length);
+}
+
+inline std::string readFile(std::string filePath) {
+    std::ifstream inFile(filePath, std::ios::binary | std::ios::ate);
+
+    if (!inFile) {
+        throw std::ios_base::failure("Failed to read from file: " + filePath);
+    }
+
+    std::streamsize fileSize = inFile.tellg();
+    inFile.seekg(0);
+
+    std::string fileData(fileSize, '\0');
+    inFile.read(fileData.data(), fileSize);
+    inFile.close();
+
+    return fileData;
+}
+
+inline std::string readFileStart(std::string filePath, size_t length) {
+    std::ifstream inFile(filePath, std::ios::binary);
+
+    if (!inFile) {
+        throw std::ios_base::failure("Failed to read from file: " + filePath);
+    }
+
+    std::string data(length, '\0');
+    inFile.read(data.data(), length);
+    data.resize(inFile.gcount());
+
+    return data;
+}
+
+inline void overwriteInFile(std::string filePath, size_t offset, std::string data) { // Fills in a field that is only known after the rest of the file was written
+    std::fstream file(filePath, std::ios::binary | std::ios::in | std::ios::out);
+
+    if (!file) {
+        throw std::ios_base::failure("Failed to write to file: " + filePath);
+    }
+
+    file.seekp(offset);
+    file.write(data.data(), data.size());
+    file.close();
+
+    if (!file) {
+        throw std::ios_base::failure("Failed to write to file: " + filePath);
+    }
+}
+
+inline void syncFile(std::string filePath) { // For files written through streams, which don't expose their descriptor
+#if POSITIONAL_FILE_IO
+    IoFile(filePath, false, false).sync();
+#endif
+}
+
+inline void syncDirectory(std::string filePath) { // Makes a rename or creation in filePath's directory durable
+#if POSITIONAL_FILE_IO
+    std::string directory = std::filesystem::path(filePath).parent_path().string();
+    int fd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0 || fsync(fd) != 0) {
+        std::string reason = std::strerror(errno);
+
+        if (fd >= 0) close(fd);
+
+        throw std::ios_base::failure("Failed to sync directory of: " + filePath + " (" + reason + ")");
+    }
+
+    close(fd);
+#endif
+}
+
+template <typename Stream>
+void streamFile(std::string inPath, std::string outPath, Stream& stream, size_t inOffset, std::string outPrefix, size_t tagOffset = 0) { // Skips inOffset input bytes and writes outPrefix ahead of the output. A non-zero tagOffset gets the GCM tag before the file is synced
+    std::ifstream inFile(inPath, std::ios::binary);
+
+    if (!inFile) {
+        throw std::ios_base::failure("Failed to read from file: " + inPath);
+    }
+
+    std::ofstream outFile(outPath, std::ios::binary);
+
+    if (!outFile) {
+        throw std::ios_base::failure("Failed to write to file: " + outPath);
+    }
+
+    inFile.seekg(inOffset);
+    outFile.write(outPrefix.data(), outPrefix.size());
+
+    std::vector<char> inBuffer(streamChunkSize);
+    std::vector<char> outBuffer(streamChunkSize + Stream::maxOverhead);
+
+    while (true) {
+        StageTimer readTimer(Stage::Read);
+        inFile.read(inBuffer.data(), inBuffer.size());
+
+        size_t length = inFile.gcount();
+        readTimer.addBytes(length);
+        readTimer.stop();
+
+        if (length == 0) break;
+
+        StageTimer cipherTimer(Stage::Cipher, length);
+        size_t written = stream.update(inBuffer.data(), length, outBuffer.data());
+        cipherTimer.stop();
+
+        StageTimer writeTimer(Stage::Write, written);
+        outFile.write(outBuffer.data(), written);
+    }
+
+    size_t written = stream.finish(outBuffer.data());
+
+    StageTimer writeTimer(Stage::Write, written);
+    outFile.write(outBuffer.data(), written);
+
+    if constexpr (requires { stream.getTag(); }) {
+        if (tagOffset > 0) outFile.seekp(tagOffset).write(stream.getTag().data(), stream.getTag().size());
+    }
+
+    outFile.close();
+
+    if (!outFile) {
+        throw std::ios_base::failure("Failed to write to file: " + outPath);
+    }
+
+    syncFile(outPath);
+}
+
+template <typename Stream>
+size_t transformBuffer(Stream& stream, const char* input, size_t length, char* output) { // output needs room for length + Stream::maxOverhead bytes
+    size_t written = stream.update(input, length, output);
+
+    return written + stream.finish(output + written);
+}
+
+template <typename Stream>
+void mapFile(std::string inPath, std::string outPath, Stream& stream, size_t inOffset, std::string outPrefix, size_t tagOffset = 0) { // Same result as streamFile, but the cipher works on the mapped pages directly. A non-zero tagOffset gets the GCM tag before commit syncs the file
+    MappedInputFile inFile(inPath);
+
+    if (inFile.size() < inOffset) {
+        throw std::runtime_error("File is shorter than its header: " + inPath);
+    }
+
+    size_t dataLength = inFile.size() - inOffset;
+    MappedOutputFile outFile(outPath, outPrefix.size() + dataLength + Stream::maxOverhead);
+
+    char* output = outFile.getData();
+
+    if (!outPrefix.empty()) std::memcpy(output, outPrefix.data(), outPrefix.size());
+
+    StageTimer cipherTimer(Stage::Cipher, dataLength); // Page faults on the mappings count here, reads and writes happen through them
+    size_t written = transformBuffer(stream, inFile.getData() + inOffset, dataLength, output + outPrefix.size());
+    cipherTimer.stop();
+
+    if constexpr (requires { stream.getTag(); }) {
+        if (tagOffset > 0) std::memcpy(output + tagOffset, stream.getTag().data(), stream.getTag().size());
+    }
+
+    StageTimer writeTimer(Stage::Write, outPrefix.size() + written);
+    outFile.commit(outPrefix.size() + written);
+}
+
+template <typename Stream>
+void pipelineFile(std::string inPath, std::string outPath, Stream& stream, size_t inOffset, std::string outPrefix, const FileIoOptions& options, size_t tagOffset = 0) { // Same result as streamFile, with reads of the next chunks and writes of the previous ones in flight while the cipher runs
+    static_assert(Stream::maxOverhead <= directIoAlignment && streamChunkSize % directIoAlignment == 0);
+
+    size_t depth = std::max<size_t>(options.queueDepth, 2); // Two at least, a chunk's carried tail comes from the previous output buffer
+
+    IoFile inFile(inPath, false, options.directIo);
+    IoFile outFile(outPath, true, options.directIo);
+
+    uint64_t fileSize = inFile.size();
+
+    if (fileSize < inOffset) {
+        throw std::runtime_error("File is shorter than its header: " + inPath);
+    }
+
+    uint64_t readStart = inOffset - inOffset % inFile.alignment(); // Direct reads start on a sector, the header bytes before inOffset are skipped in memory
+    size_t skip = inOffset - readStart;
+    size_t chunkCount = (fileSize - readStart + streamChunkSize - 1) / streamChunkSize;
+    size_t outCapacity = streamChunkSize + 2 * directIoAlignment; // Chunk output, stream overhead and the unaligned tail carried over from the previous chunk
+
+    std::vector<PooledBuffer> inBuffers;
+    std::vector<PooledBuffer> outBuffers;
+
+    for (size_t i = 0; i < depth; i++) { // Pooled, so a batch of files reuses the same buffers instead of allocating them per file
+        inBuffers.push_back(BufferPool::shared().acquire(streamChunkSize));
+        outBuffers.push_back(BufferPool::shared().acquire(outCapacity));
+    }
+
+    std::vector<IoRequest> reads(depth);
+    std::vector<IoRequest> writes(depth);
+    AsyncFileIo io(options.method, static_cast<unsigned>(2 * depth)); // Declared after the buffers and requests, so it finishes with them before they are freed
+
+    auto submitRead = [&](size_t chunk) {
+        uint64_t offset = readStart + chunk * streamChunkSize;
+        size_t wanted = static_cast<size_t>(std::min<uint64_t>(streamChunkSize, fileSize - offset));
+
+        reads[chunk % depth].reset(inFile.get(), inBuffers[chunk % depth].chars(), inFile.isDirect() ? streamChunkSize : wanted, offset, wanted, false);
+        io.submit(reads[chunk % depth]);
+    };
+
+    auto awaitRequest = [&](IoRequest& request) {
+        io.waitFor(request);
+
+        if (request.error != 0) {
+            throw std::ios_base::failure((request.write ? "Failed to write to file: " + outPath : "Failed to read from file: " + inPath) + " (" + std::strerror(request.error) + ")");
+        }
+    };
+
+    uint64_t outOffset = 0;
+    size_t carry = outPrefix.size(); // Bytes at carrySource not written yet, they lead the next output buffer
+    const char* carrySource = outPrefix.data();
+
+    auto nextOutput = [&](size_t chunk) { // Waits for the buffer's previous write and moves the carried bytes to its front
+        char* output = outBuffers[chunk % depth].chars();
+
+        StageTimer writeTimer(Stage::Write, writes[chunk % depth].complete ? 0 : writes[chunk % depth].wanted);
+        awaitRequest(writes[chunk % depth]);
+        writeTimer.stop();
+
+        std::memcpy(output, carrySource, carry);
+
+        return output;
+    };
+
+    auto submitWrite = [&](size_t chunk, char* output, size_t length) {
+        writes[chunk % depth].reset(outFile.get(), output, length, outOffset, length, true);
+        io.submit(writes[chunk % depth]);
+        outOffset += length;
+    };
+
+    for (size_t chunk = 0; chunk < std::min(depth, chunkCount); chunk++) {
+        submitRead(chunk);
+    }
+
+    for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+        IoRequest& read = reads[chunk % depth];
+        StageTimer readTimer(Stage::Read, read.wanted); // Only the time spent waiting, the read itself overlapped with earlier chunks
+        awaitRequest(read);
+        readTimer.stop();
+
+        if (read.transferred < read.wanted) {
+            throw std::runtime_error("File was truncated while reading: " + inPath);
+        }
+
+        size_t begin = chunk == 0 ? skip : 0;
+        char* output = nextOutput(chunk);
+
+        StageTimer cipherTimer(Stage::Cipher, read.wanted - begin);
+        size_t filled = carry + stream.update(read.buffer + begin, read.wanted - begin, output + carry);
+        cipherTimer.stop();
+
+        if (chunk + depth < chunkCount) submitRead(chunk + depth); // The input buffer was fully consumed by update
+
+        size_t writable = filled - filled % outFile.alignment(); // Direct writes go out in whole sectors, the rest waits for the next chunk
+
+        if (writable > 0) submitWrite(chunk, output, writable);
+
+        carry = filled - writable;
+        carrySource = output + writable;
+    }
+
+    char* output = nextOutput(chunkCount);
+    size_t filled = carry + stream.finish(output + carry);
+    size_t padded = (filled + outFile.alignment() - 1) / outFile.alignment() * outFile.alignment();
+    uint64_t totalLength = outOffset + filled;
+
+    std::memset(output + filled, 0, padded - filled);
+
+    if (padded > 0) submitWrite(chunkCount, output, padded);
+
+    StageTimer writeTimer(Stage::Write);
+
+    for (IoRequest& write : writes) {
+        if (!write.complete) writeTimer.addBytes(write.wanted);
+
+        awaitRequest(write);
+    }
+
+    if (padded != filled) outFile.truncate(totalLength);
+
+    if constexpr (requires { stream.getTag(); }) {
+        std::string tag(stream.getTag().begin(), stream.getTag().end());
+
+        if (tagOffset > 0 && outFile.isDirect()) overwriteInFile(outPath, tagOffset, tag); // Too small for a direct write, it goes through the page cache and the sync below still covers it
+        else if (tagOffset > 0) outFile.writeAt(tag.data(), tag.size(), tagOffset);
+    }
+
+    outFile.sync();
+}
+
+template <typename Stream>
+void transformFile(const FileIoOptions& options, std::string inPath, std::string outPath, Stream& stream, size_t inOffset, std::string outPrefix, size_t tagOffset = 0) { // Every method leaves the output synced, with the GCM tag at a non-zero tagOffset
+    if (options.method == IoMethod::Mmap) mapFile(inPath, outPath, stream, inOffset, outPrefix, tagOffset);
+    else if (!options.pipelined()) streamFile(inPath, outPath, stream, inOffset, outPrefix, tagOffset);
+    else pipelineFile(inPath, outPath, stream, inOffset, outPrefix, options, tagOffset);
+}
+
+inline void renameFile(std::string filePath, std::string newPath) {
+    if (std::rename(filePath.c_str(), newPath.c_str()) != 0) {
+        throw std::runtime_error("Failed to rename file: " + filePath);
+    }
+}
+
+inline void deleteFile(std::string filePath) {
+    if (std::remove(filePath.c_str()) != 0) {
+        throw std::runtime_error("Failed to delete file: " + filePath);
+    }
+}
+
+// What new encrypted files look like, decryption reads all of it from the header instead
+struct EncryptionOptions {
+    CipherMode mode = CipherMode::GCM;
+    size_t chunkSize = size_t(1) << 20; // Power of two, 0 writes the single stream format of version 2 instead of a chunked file
+    CipherVariant variant = CipherVariant::Aes128; // Only AES-128 has a stream format, the other variants need chunking on
+};
+
+inline bool validChunkSize(size_t chunkSize) {
+    return chunkSize == 0 || (std::has_single_bit(chunkSize) && chunkSize >= (size_t(1) << FileHeader::minChunkSizeLog2) && chunkSize <= (size_t(1) << FileHeader::maxChunkSizeLog2));
+}
+
+static_assert(FileHeader::gcmIvLength == GcmStream<cols, rows, rounds>::ivLength && FileHeader::maxIvLength == blockSize, "Header IV lengths must match the streams");
+
+inline FileHeader newHeader(CipherMode mode, const PasswordKeys& keys, size_t chunkSize = 0, CipherVariant variant = CipherVariant::Aes128) { // Fresh IV, and the run's KDF settings and salt
+    if (!validChunkSize(chunkSize)) {
+        throw std::invalid_argument("Chunk size must be 0 or a power of two from 4 KiB to 1 GiB");
+    }
+
+    if (chunkSize == 0 && variant != CipherVariant::Aes128) {
+        throw std::invalid_argument("Only chunked files record the key size, 192 and 256-bit keys need a chunk size");
+    }
+
+    FileHeader header;
+    header.version = chunkSize > 0 ? FileHeader::currentVersion : FileHeader::streamVersion;
+    header.chunkSizeLog2 = chunkSize > 0 ? static_cast<uint8_t>(std::countr_zero(chunkSize)) : header.chunkSizeLog2;
+    header.mode = mode;
+    header.variant = variant;
+    header.kdf = keys.getEncryptionKdf();
+    header.iv = generateIV(FileHeader::ivLengthFor(mode));
+
+    return header;
+}
+
+template <size_t rounds, typename Body>
+void runCipher(FileHeader& header, const KeySchedule<cols, rows, rounds>& keySchedule, bool decrypting, ThreadPool* pool, Body&& body) { // Builds the stream for the header's mode and passes it to body, GCM encryption leaves its tag in the header
+    if (header.mode == CipherMode::GCM) {
+        GcmStream<cols, rows, rounds> stream(keySchedule, roundEngine, header.iv, decrypting, pool);
+        std::string authenticatedData = header.authenticatedData();
+
+        stream.addAuthenticatedData(authenticatedData.data(), authenticatedData.size());
+        stream.setExpectedTag(header.tag);
+        body(stream);
+
+        if (!decrypting) header.tag = stream.getTag();
+    } else if (header.mode == CipherMode::CTR) {
+        CtrStream<cols, rows, rounds> stream(keySchedule, roundEngine, Block<cols, rows>::fromString(header.iv), pool);
+        body(stream);
+    } else {
+        CbcStream<cols, rows, rounds> stream(keySchedule, roundEngine, Block<cols, rows>::fromString(header.iv), decrypting, pool);
+        body(stream);
+    }
+}
+
+// In memory counterparts of processFile, producing and reading the same header plus ciphertext layout as an encrypted file.
+// The result starts with prefixSpace unused bytes, so a caller can put its own framing in front without copying the data again.
+inline std::string encryptData(const char* data, size_t length, PasswordKeys& keys, const EncryptionOptions& options, size_t prefixSpace = 0) {
+    FileHeader header = newHeader(options.mode, keys, options.chunkSize, options.variant);
+
+    if (header.isChunked()) {
+        return withCipherVariant(header.variant, [&](auto shape) {
+            std::shared_ptr<const typename decltype(shape)::Schedule> keySchedule = keys.get<decltype(shape)>(header.kdf);
+            StageTimer cipherTimer(Stage::Cipher, length);
+
+            return encryptChunkedData(data, length, header, *keySchedule, prefixSpace);
+        });
+    }
+
+    std::shared_ptr<const PasswordKeys::Schedule> keySchedule = keys.get(header.kdf);
+
+    std::string output(prefixSpace + header.size() + length + blockSize, '\0'); // A block covers the largest stream overhead, CBC padding
+    size_t written = prefixSpace + header.size();
+
+    StageTimer cipherTimer(Stage::Cipher, length);
+
+    runCipher(header, *keySchedule, false, nullptr, [&](auto& stream) {
+        written += transformBuffer(stream, data, length, output.data() + written);
+    });
+
+    cipherTimer.stop();
+
+    std::string headerBytes = header.serialize(); // Serialized last, the GCM tag is only known now
+    std::copy(headerBytes.begin(), headerBytes.end(), output.begin() + prefixSpace);
+    output.resize(written);
+
+    return output;
+}
+
+inline std::string decryptData(const char* data, size_t length, PasswordKeys& keys, size_t prefixSpace = 0) { // Also takes chunked files
+    FileHeader header = FileHeader::parse(std::string(data, std::min(length, FileHeader::maxSize)));
+
+    if (header.isChunked()) {
+        return withCipherVariant(header.variant, [&](auto shape) {
+            std::shared_ptr<const typename decltype(shape)::Schedule> keySchedule = keys.get<decltype(shape)>(header.kdf);
+            StageTimer cipherTimer(Stage::Cipher, length - header.size());
+
+            return decryptChunkedData(data, length, header, *keySchedule, prefixSpace);
+        });
+    }
+
+    std::shared_ptr<const PasswordKeys::Schedule> keySchedule = keys.get(header.kdf); // Stream format files are always AES-128
+
+    std::string output(prefixSpace + length - header.size() + blockSize, '\0');
+    size_t written = prefixSpace;
+
+    StageTimer cipherTimer(Stage::Cipher, length - header.size());
+
+    runCipher(header, *keySchedule, true, nullptr, [&](auto& stream) {
+        written += transformBuffer(stream, data + header.size(), length - header.size(), output.data() + written);
+    });
+
+    cipherTimer.stop();
+
+    output.resize(written);
+
+    return output;
+}
+
+struct FileResult {
+    std::string filePath;
+    uint64_t bytes = 0;
+    std::string error; // Empty when the file was processed
+};
+
+// Encrypts or decrypts one file in place by its extension, returns the bytes read. Chunked files are read and written at chunk offsets
+// by the pool's threads, through io's method like the stream format
+inline uint64_t processFile(std::string filePath, PasswordKeys& keys, const EncryptionOptions& options, const FileIoOptions& io, ThreadPool* pool) {
+    bool encrypted = std::filesystem::path(filePath).extension() == encryptedExtension;
+
+    std::string rootFilePath = encrypted ? filePath.substr(0, filePath.length() - encryptedExtension.size()) : filePath;
+    std::string outputPath = encrypted ? rootFilePath : rootFilePath + encryptedExtension;
+    std::string tempPath = outputPath + tempExtension;
+
+    StageTimer fileTimer(Stage::File);
+    StageTimer headerTimer(Stage::Header);
+
+    FileHeader header;
+
+    if (encrypted) {
+        std::string headerBytes = readFileStart(filePath, FileHeader::maxSize);
+
+        if (FileHeader::matches(headerBytes)) {
+            header = FileHeader::parse(headerBytes);
+        } else if (std::filesystem::exists(rootFilePath + ivExtension)) { // Written before the header and before the S-box direction fix, unauthenticated CBC that no longer decrypts, so it is left untouched
+            throw std::runtime_error("File uses the pre-header format with a .iv file, which is no longer supported: " + filePath);
+        } else {
+            throw std::runtime_error("File has no encryption header: " + filePath);
+        }
+    } else {
+        header = newHeader(options.mode, keys, options.chunkSize, options.variant);
+    }
+
+    headerTimer.stop();
+
+    if (!encrypted && header.mode == CipherMode::CBC && !header.isChunked()) pool = nullptr; // CBC encryption of one stream stays on one thread, each step needs the previous result
+
+    size_t inOffset = encrypted ? header.size() : 0;
+    std::string outPrefix = encrypted ? "" : header.serialize();
+    uint64_t fileSize = std::filesystem::file_size(filePath);
+    bool writesTag = !encrypted && header.mode == CipherMode::GCM && !header.isChunked(); // Only known once the data is encrypted
+
+    try { // Output goes to a temporary file so a failure part way through never leaves a truncated result under the real name
+        withCipherVariant(header.variant, [&](auto shape) { // Resolved once here, everything below runs that variant's own instantiations
+            StageTimer keyTimer(Stage::KeyDerivation);
+            std::shared_ptr<const typename decltype(shape)::Schedule> keySchedule = keys.get<decltype(shape)>(header.kdf); // Derived from the password with the salt and costs in the header
+            keyTimer.stop();
+
+            if (header.isChunked()) {
+                if (encrypted) ChunkedFileReader(filePath, keys).decryptTo(tempPath, pool, io);
+                else encryptChunkedFile(filePath, tempPath, header, *keySchedule, pool, io);
+            } else {
+                runCipher(header, *keySchedule, encrypted, pool, [&](auto& stream) {
+                    transformFile(io, filePath, tempPath, stream, inOffset, outPrefix, writesTag ? header.tagOffset() : 0);
+                });
+            }
+        });
+
+    } catch (...) {
+        std::remove(tempPath.c_str());
+
+        throw;
+    }
+
+    StageTimer commitTimer(Stage::Commit);
+
+    renameFile(tempPath, outputPath); // Every writer has synced tempPath by now, mapped files in commit
+    syncDirectory(outputPath); // The new name is on disk before the only other copy of the data goes
+    deleteFile(filePath);
+
+    commitTimer.stop();
+    fileTimer.addBytes(fileSize);
+
+    return fileSize;
+}
+
+inline std::vector<std::string> collectFiles(const std::vector<std::string>& paths) { // Expands directories recursively, skipping leftovers of interrupted runs and legacy IV files
+    std::vector<std::string> files;
+
+    auto addFile = [&](const std::filesystem::path& path) {
+        std::string extension = path.extension().string();
+
+        if (extension != tempExtension && extension != ivExtension) files.push_back(path.string());
+    };
+
+    for (const std::string& path : paths) {
+        if (!std::filesystem::is_directory(path)) {
+            files.push_back(path);
+
+            continue;
+        }
+
+        for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator(path)) {
+            if (entry.is_regular_file()) addFile(entry.path());
+        }
+    }
+
+    return files;
+}
+
+inline std::vector<FileResult> processFiles(const std::vector<std::string>& files, PasswordKeys& keys, const EncryptionOptions& options, const FileIoOptions& io, ThreadPool& pool) {
+    std::vector<FileResult> results(files.size());
+    std::atomic<size_t> nextFile = 0;
+
+    pool.parallelFor(pool.size(), [&](size_t, size_t) { // One loop per thread pulling the next file, each holds at most one file's buffers so memory stays bounded by the thread count
+        size_t f;
+
+        while ((f = nextFile++) < files.size()) {
+            results[f].filePath = files[f];
+
+            try {
+                results[f].bytes = processFile(files[f], keys, options, io, nullptr);
+            } catch (const std::exception& error) {
+                results[f].error = error.what();
+                Stats::global().recordFailure();
+            }
+        }
+    });
+
+    return results;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+#include "kdf.hpp"
+#include "cipher_variant.hpp"
+
+enum class CipherMode : uint8_t {
+    CBC = 0,
+    CTR = 1,
+    GCM = 2
+};
+
+// Fixed size header written at the start of every encrypted file, so the mode, IV and key derivation settings travel with the data
+// instead of in a separate .iv file. Layout: magic, version, mode, IV length, KDF, IV (zero padded), salt, KDF costs, tag.
+// Version 3 headers start chunked files (see chunked_file.hpp): the tag is replaced by the chunk size, the cipher variant and 6 reserved
+// bytes, every chunk carries its own tag instead. Version 2 files are always AES-128.
+struct FileHeader {
+    static constexpr std::array<char, 4> magic = {'D', 'I', 'Y', 'E'};
+    static constexpr uint8_t currentVersion = 3;
+    static constexpr uint8_t streamVersion = 2; // Latest version holding the data as one stream, still written when chunking is off
+
+    static constexpr size_t maxIvLength = 16;
+    static constexpr size_t gcmIvLength = 12;
+    static constexpr size_t tagLength = 16;
+    static constexpr size_t ivOffset = 8;
+    static constexpr size_t saltOffset = ivOffset + maxIvLength;
+    static constexpr size_t kdfOffset = saltOffset + KdfParameters::saltLength;
+    static constexpr size_t chunkOffset = kdfOffset + KdfParameters::encodedLength;
+    static constexpr size_t variantOffset = chunkOffset + 1;
+    static constexpr size_t maxSize = kdfOffset + KdfParameters::encodedLength + tagLength;
+
+    static constexpr uint8_t minChunkSizeLog2 = 12;
+    static constexpr uint8_t maxChunkSizeLog2 = 30; // A chunk's ciphertext length has to fit the index's 32-bit field
+
+    uint8_t version = currentVersion;
+    CipherMode mode = CipherMode::GCM;
+    std::string iv;
+    KdfParameters kdf;
+    std::array<char, tagLength> tag{}; // Only used by GCM in version 2, left zero otherwise
+    uint8_t chunkSizeLog2 = 20; // Version 3 only
+    CipherVariant variant = CipherVariant::Aes128; // Version 3 only
+
+    static constexpr size_t ivLengthFor(CipherMode mode) { // A whole block for CBC and CTR, GCM's 96-bit nonce
+        return mode == CipherMode::GCM ? gcmIvLength : maxIvLength;
+    }
+
+    static constexpr size_t tagOffsetFor(uint8_t version) { // Version 3 has no tag, this is where its header ends
+        return version == streamVersion ? chunkOffset : chunkOffset + 8;
+    }
+
+    static constexpr size_t sizeFor(uint8_t version) {
+        return version >= 3 ? tagOffsetFor(version) : tagOffsetFor(version) + tagLength;
+    }
+
+    bool isChunked() const {
+        return version >= 3;
+    }
+
+    size_t chunkSize() const {
+        return size_t(1) << chunkSizeLog2;
+    }
+
+    size_t tagOffset() const {
+        return tagOffsetFor(version);
+    }
+
+    size_t size() const {
+        return sizeFor(version);
+    }
+
+    static bool matches(const std::string& bytes) { // Files from before the header existed start straight with ciphertext
+        return bytes.size() >= std::min(sizeFor(streamVersion), sizeFor(currentVersion)) && std::equal(magic.begin(), magic.end(), bytes.begin());
+    }
+
+    static FileHeader parse(const std::string& bytes) {
+        if (!matches(bytes)) {
+            throw std::runtime_error("File does not start with an encryption header");
+        }
+
+        FileHeader header;
+        header.version = static_cast<uint8_t>(bytes[4]);
+
+        if (header.version < streamVersion || header.version > currentVersion) { // Version 1, unsalted and keyed by the raw password, is not supported
+            throw std::runtime_error("Unsupported header version " + std::to_string(header.version));
+        }
+
+        uint8_t modeValue = static_cast<uint8_t>(bytes[5]);
+        uint8_t ivLength = static_cast<uint8_t>(bytes[6]);
+        uint8_t kdfValue = static_cast<uint8_t>(bytes[7]);
+
+        if (modeValue > static_cast<uint8_t>(CipherMode::GCM) || ivLength != ivLengthFor(static_cast<CipherMode>(modeValue)) || kdfValue > static_cast<uint8_t>(KdfAlgorithm::Scrypt) || bytes.size() < header.size()) {
+            throw std::runtime_error("Corrupt encryption header");
+        }
+
+        if (header.isChunked()) {
+            header.chunkSizeLog2 = static_cast<uint8_t>(bytes[chunkOffset]);
+
+            if (header.chunkSizeLog2 < minChunkSizeLog2 || header.chunkSizeLog2 > maxChunkSizeLog2) {
+                throw std::runtime_error("Corrupt encryption header, chunk size out of range");
+            }
+
+            uint8_t variantValue = static_cast<uint8_t>(bytes[variantOffset]);
+
+            if (variantValue > static_cast<uint8_t>(CipherVariant::Aes256)) {
+                throw std::runtime_error("Unsupported cipher variant " + std::to_string(variantValue));
+            }
+
+            header.variant = static_cast<CipherVariant>(variantValue);
+        }
+
+        header.mode = static_cast<CipherMode>(modeValue);
+        header.iv = bytes.substr(ivOffset, ivLength);
+
+        const uint8_t* raw = reinterpret_cast<const uint8_t*>(bytes.data());
+        header.kdf = KdfParameters::decode(static_cast<KdfAlgorithm>(kdfValue), raw + saltOffset, raw + kdfOffset);
+
+        if (!header.isChunked()) std::copy_n(bytes.begin() + header.tagOffset(), tagLength, header.tag.begin());
+
+        return header;
+    }
+
+    std::string serialize() const { // Writes the layout of this header's version, so authenticated data of version 2 files is reproduced exactly
+        std::string bytes(size(), '\0');
+        std::array<uint8_t, KdfParameters::encodedLength> encoded = kdf.encode();
+
+        std::copy(magic.begin(), magic.end(), bytes.begin());
+        bytes[4] = static_cast<char>(version);
+        bytes[5] = static_cast<char>(mode);
+        bytes[6] = static_cast<char>(iv.length());
+        bytes[7] = static_cast<char>(kdf.algorithm);
+        bytes.replace(ivOffset, iv.length(), iv);
+        std::copy(kdf.salt.begin(), kdf.salt.end(), bytes.begin() + saltOffset);
+        std::copy(encoded.begin(), encoded.end(), bytes.begin() + kdfOffset);
+
+        if (isChunked()) {
+            bytes[chunkOffset] = static_cast<char>(chunkSizeLog2);
+            bytes[variantOffset] = static_cast<char>(variant);
+        } else {
+            std::copy(tag.begin(), tag.end(), bytes.begin() + tagOffset());
+        }
+
+        return bytes;
+    }
+
+    std::string authenticatedData() const { // Everything before the tag, so GCM also detects a changed mode, IV or KDF setting
+        return serialize().substr(0, tagOffset());
+    }
+};
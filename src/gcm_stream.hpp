@@ -0,0 +1,140 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+#include "block.hpp"
+#include "key_schedule.hpp"
+#include "round_engine.hpp"
+#include "ctr_stream.hpp"
+#include "ghash.hpp"
+#include "thread_pool.hpp"
+
+// GCM authenticated encryption. The data goes through CTR starting at J0 + 1 and GHASH over the ciphertext, in slices small enough
+// that the hash reads each slice while it is still in cache. The tag is E(J0) added to the final hash.
+template <size_t cols, size_t rows, size_t rounds>
+class GcmStream {
+    static constexpr size_t blockSize = cols * rows;
+    static constexpr size_t sliceSize = 1 << 18; // Bytes encrypted before being hashed, fits in L2 on most cores
+    static constexpr uint64_t maxTextLength = (uint64_t(1) << 36) - 32; // 2^39 - 256 bits, the counter's low 32 bits must never wrap
+
+    static_assert(blockSize == GHash::blockSize, "GCM is only defined for 128-bit blocks");
+
+public:
+    static constexpr size_t ivLength = 12;
+    static constexpr size_t tagLength = 16;
+
+    using Tag = std::array<char, tagLength>;
+
+private:
+    const KeySchedule<cols, rows, rounds>& keySchedule;
+    const RoundEngine<rows>& engine;
+    bool decrypting;
+
+    CtrStream<cols, rows, rounds> ctr;
+    GHash ghash;
+    Block<cols, rows> tagMask;
+    Tag tag{};
+
+    uint64_t aadLength = 0;
+    uint64_t textLength = 0;
+
+    static Block<cols, rows> counterBlock(const std::string& iv) { // J0 = IV || 0^31 || 1 for the standard 96-bit IV
+        if (iv.length() != ivLength) {
+            throw std::invalid_argument("GCM IV must be " + std::to_string(ivLength) + " bytes");
+        }
+
+        return Block<cols, rows>::fromString(iv + std::string(3, '\0') + '\1');
+    }
+
+    GHash::Bytes hashKey() const {
+        Block<cols, rows> zero;
+        GHash::Bytes bytes;
+
+        engine.encrypt(zero, keySchedule);
+        std::memcpy(bytes.data(), &zero, blockSize);
+
+        return bytes;
+    }
+
+public:
+    static_assert(sizeof(Block<cols, rows>) == blockSize, "Blocks must be stored as plain bytes to be hashed");
+
+    static constexpr size_t maxOverhead = 0;
+
+    GcmStream(const KeySchedule<cols, rows, rounds>& keySchedule, const RoundEngine<rows>& engine, const std::string& iv, bool decrypting, ThreadPool* pool = nullptr)
+        : keySchedule(keySchedule), engine(engine), decrypting(decrypting), ctr(keySchedule, engine, counterBlock(iv), pool), ghash(hashKey()), tagMask(counterBlock(iv)) {
+        engine.encrypt(tagMask, keySchedule);
+        ctr.seek(blockSize);
+    }
+
+    void addAuthenticatedData(const char* data, size_t length) { // Must come before any update
+        if (textLength > 0) {
+            throw std::logic_error("Authenticated data has to be added before the text");
+        }
+
+        ghash.update(reinterpret_cast<const uint8_t*>(data), length);
+        aadLength += length;
+    }
+
+    void setExpectedTag(const Tag& expected) { // Decryption checks against this in finish
+        tag = expected;
+    }
+
+    const Tag& getTag() const { // Valid after finish when encrypting
+        return tag;
+    }
+
+    size_t update(const char* input, size_t length, char* output) {
+        if (length > maxTextLength - textLength) {
+            throw std::length_error("Data is too long for a single GCM message");
+        }
+
+        if (textLength == 0) ghash.pad();
+
+        for (size_t start = 0; start < length; start += sliceSize) {
+            size_t slice = std::min(sliceSize, length - start);
+
+            if (decrypting) ghash.update(reinterpret_cast<const uint8_t*>(input + start), slice); // Hash the ciphertext before output might overwrite it
+
+            ctr.update(input + start, slice, output + start);
+
+            if (!decrypting) ghash.update(reinterpret_cast<const uint8_t*>(output + start), slice);
+        }
+
+        textLength += length;
+
+        return length;
+    }
+
+    size_t finish(char*) { // Throws when decrypting and the tag does not match, the caller must discard everything written
+        GHash::Bytes hash = ghash.finish(aadLength, textLength);
+        Tag computed;
+
+        for (size_t i = 0; i < tagLength; i++) {
+            computed[i] = static_cast<char>(hash[i] ^ tagMask[i / rows][i % rows].get());
+        }
+
+        if (!decrypting) {
+            tag = computed;
+
+            return 0;
+        }
+
+        uint8_t difference = 0;
+
+        for (size_t i = 0; i < tagLength; i++) { // Constant time, stopping at the first mismatch would leak how much of a forged tag was right
+            difference |= static_cast<uint8_t>(computed[i] ^ tag[i]);
+        }
+
+        if (difference != 0) {
+            throw std::runtime_error("Authentication failed, the data or its header was modified or the key is wrong");
+        }
+
+        return 0;
+    }
+};
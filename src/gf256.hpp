@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstdint>
+#include <array>
+#include <type_traits>
 #include <string>
 #include <bitset>
 #include <ostream>
@@ -18,6 +20,18 @@ enum class GFFormat {
     Poly
 };
 
+enum class GFBackend {
+    Compute, // Shift-and-add followed by long division, same as the compile time path
+    LogTable, // Log/antilog tables (768 bytes), multiplication becomes two lookups and an addition
+    FullTable // Full 256x256 product table (64 KiB), multiplication becomes a single lookup
+};
+
+#ifndef GF256_BACKEND
+#define GF256_BACKEND LogTable
+#endif
+
+constexpr GFBackend gfBackend = GFBackend::GF256_BACKEND;
+
 class GF256 {
     uint8_t value;
 
@@ -97,18 +111,7 @@ class GF256 {
 
     static constexpr char hexDigits[] = "0123456789ABCDEF";
 
-public:
-    constexpr GF256(uint8_t v = 0) : value(v) {}
-
-    constexpr uint8_t get() const {
-        return value;
-    }
-
-    constexpr GF256 operator-() const {
-        return *this;
-    }
-
-    constexpr GF256 inv() const { // Utilizes euclidean algorithm while keeping track of coefficients and ensuring that the Bezout identity is satisfied for the remainder at each step
+    static constexpr uint8_t gfInverse(uint8_t value) { // Utilizes euclidean algorithm while keeping track of coefficients and ensuring that the Bezout identity is satisfied for the remainder at each step
         if (value == 0) return 0;
         if (value == 1) return 1;
 
@@ -132,6 +135,26 @@ public:
         return prevCoeff; // n_0, where m_0 * a + n_0 * b = 1 --> gcd(a, b)
     }
 
+    static constexpr uint8_t multiply(uint8_t a, uint8_t b);
+    static constexpr uint8_t inverse(uint8_t value);
+
+    friend struct GFTables;
+
+public:
+    constexpr GF256(uint8_t v = 0) : value(v) {}
+
+    constexpr uint8_t get() const {
+        return value;
+    }
+
+    constexpr GF256 operator-() const {
+        return *this;
+    }
+
+    constexpr GF256 inv() const {
+        return inverse(value);
+    }
+
     constexpr GF256 operator+(GF256 other) const {
         return GF256(value ^ other.value);
     }
@@ -153,11 +176,11 @@ public:
     }
 
     constexpr GF256 operator*(GF256 other) const {
-        return GF256(gfMultiply(value, other.value));
+        return GF256(multiply(value, other.value));
     }
 
     constexpr GF256& operator*=(GF256 other) {
-        value = gfMultiply(value, other.value);
+        value = multiply(value, other.value);
 
         return *this;
     }
@@ -241,4 +264,78 @@ public:
 
         return stream;
     }
-};
\ No newline at end of file
+};
+
+struct GFTables { // Generated at compile time through the long division path, which is why GF256 only uses them outside of constant evaluation
+    static constexpr uint8_t generator = 3; // x + 1, primitive for the field so its powers cover every non-zero element
+
+    static constexpr std::array<uint8_t, 510> exp = []() constexpr { // Doubled so the sum of two logs never needs reducing mod 255
+        std::array<uint8_t, 510> table{};
+        uint8_t power = 1;
+
+        for (int i = 0; i < 255; i++) {
+            table[i] = power;
+            table[i + 255] = power;
+            power = GF256::gfMultiply(power, generator);
+        }
+
+        return table;
+    }();
+
+    static constexpr std::array<uint8_t, 256> log = []() constexpr {
+        std::array<uint8_t, 256> table{};
+
+        for (int i = 0; i < 255; i++) {
+            table[exp[i]] = i;
+        }
+
+        return table;
+    }();
+
+    static constexpr std::array<uint8_t, 256> inverse = []() constexpr {
+        std::array<uint8_t, 256> table{};
+
+        for (int i = 1; i < 256; i++) {
+            table[i] = exp[255 - log[i]];
+        }
+
+        return table;
+    }();
+
+    template <bool enabled = true> // Only instantiated (and emitted) when the full table backend is selected
+    static constexpr std::array<std::array<uint8_t, 256>, 256> product = []() constexpr {
+        std::array<std::array<uint8_t, 256>, 256> table{};
+
+        for (int a = 1; a < 256; a++) {
+            for (int b = 1; b < 256; b++) {
+                table[a][b] = exp[log[a] + log[b]];
+            }
+        }
+
+        return table;
+    }();
+};
+
+constexpr uint8_t GF256::multiply(uint8_t a, uint8_t b) {
+    if (std::is_constant_evaluated()) return gfMultiply(a, b);
+
+    if constexpr (gfBackend == GFBackend::FullTable) {
+        return GFTables::product<>[a][b];
+    } else if constexpr (gfBackend == GFBackend::LogTable) {
+        if (a == 0 || b == 0) return 0;
+
+        return GFTables::exp[GFTables::log[a] + GFTables::log[b]];
+    } else {
+        return gfMultiply(a, b);
+    }
+}
+
+constexpr uint8_t GF256::inverse(uint8_t value) {
+    if (std::is_constant_evaluated()) return gfInverse(value);
+
+    if constexpr (gfBackend == GFBackend::Compute) {
+        return gfInverse(value);
+    } else {
+        return GFTables::inverse[value];
+    }
+}
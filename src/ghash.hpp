@@ -0,0 +1,279 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "cpu_features.hpp"
+
+// GHASH from GCM, a polynomial hash over GF(2^128) keyed by H. Uses carry-less multiply when the CPU has it,
+// otherwise Shoup's 4-bit tables (16 multiples of H plus a fixed reduction table).
+class GHash {
+public:
+    static constexpr size_t blockSize = 16;
+
+    using Bytes = std::array<uint8_t, blockSize>;
+
+private:
+    Bytes state{};
+    Bytes partial{}; // Bytes of an unfinished block carried between updates
+    size_t partialLength = 0;
+
+    std::array<uint64_t, 16> tableHigh{}; // i * H for every 4-bit i, split into big endian halves
+    std::array<uint64_t, 16> tableLow{};
+
+    bool useClmul = false;
+
+#if CPU_X86
+    __m128i hPowers[4]; // H, H^2, H^3, H^4 byte reflected, so four blocks share one reduction
+#endif
+
+    static constexpr std::array<uint16_t, 16> reductionTable = []() constexpr { // What the 4 bits shifted out of the low end fold back in as, reduced by x^128 + x^7 + x^2 + x + 1
+        std::array<uint16_t, 16> table{};
+
+        for (int i = 0; i < 16; i++) {
+            for (int bit = 0; bit < 4; bit++) {
+                if (i >> bit & 1) table[i] ^= 0xE100 >> (3 - bit);
+            }
+        }
+
+        return table;
+    }();
+
+    static uint64_t loadBigEndian(const uint8_t* bytes) {
+        uint64_t value = 0;
+
+        for (int i = 0; i < 8; i++) {
+            value = value << 8 | bytes[i];
+        }
+
+        return value;
+    }
+
+    static void storeBigEndian(uint8_t* bytes, uint64_t value) {
+        for (int i = 7; i >= 0; i--) {
+            bytes[i] = static_cast<uint8_t>(value);
+            value >>= 8;
+        }
+    }
+
+    void generateTables(const Bytes& hashKey) {
+        uint64_t high = loadBigEndian(hashKey.data());
+        uint64_t low = loadBigEndian(hashKey.data() + 8);
+
+        tableHigh[8] = high;
+        tableLow[8] = low;
+
+        for (int i = 4; i > 0; i >>= 1) { // Entry 8 is H itself since the bits are reflected, each halving multiplies by x
+            uint64_t carry = (low & 1) * 0xE1000000;
+
+            low = (high << 63) | (low >> 1);
+            high = (high >> 1) ^ (carry << 32);
+
+            tableHigh[i] = high;
+            tableLow[i] = low;
+        }
+
+        for (int i = 2; i <= 8; i *= 2) {
+            for (int j = 1; j < i; j++) {
+                tableHigh[i + j] = tableHigh[i] ^ tableHigh[j];
+                tableLow[i + j] = tableLow[i] ^ tableLow[j];
+            }
+        }
+    }
+
+    void multiplyTable(Bytes& x) const { // x = x * H, one nibble at a time from the last byte
+        uint8_t nibble = x[15] & 0xF;
+        uint64_t high = tableHigh[nibble];
+        uint64_t low = tableLow[nibble];
+
+        for (int i = 15; i >= 0; i--) {
+            uint8_t lowNibble = x[i] & 0xF;
+            uint8_t highNibble = x[i] >> 4;
+
+            if (i != 15) {
+                uint8_t remainder = low & 0xF;
+
+                low = (high << 60) | (low >> 4);
+                high = (high >> 4) ^ (static_cast<uint64_t>(reductionTable[remainder]) << 48);
+                high ^= tableHigh[lowNibble];
+                low ^= tableLow[lowNibble];
+            }
+
+            uint8_t remainder = low & 0xF;
+
+            low = (high << 60) | (low >> 4);
+            high = (high >> 4) ^ (static_cast<uint64_t>(reductionTable[remainder]) << 48);
+            high ^= tableHigh[highNibble];
+            low ^= tableLow[highNibble];
+        }
+
+        storeBigEndian(x.data(), high);
+        storeBigEndian(x.data() + 8, low);
+    }
+
+    void hashBlocksTable(const uint8_t* data, size_t count) {
+        for (size_t b = 0; b < count; b++) {
+            for (size_t i = 0; i < blockSize; i++) {
+                state[i] ^= data[b * blockSize + i];
+            }
+
+            multiplyTable(state);
+        }
+    }
+
+#if CPU_X86
+    CPU_TARGET("pclmul,ssse3")
+    static __m128i byteSwap(__m128i value) {
+        return _mm_shuffle_epi8(value, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    }
+
+    CPU_TARGET("pclmul,ssse3")
+    static void multiplyAccumulate(__m128i a, __m128i b, __m128i& low, __m128i& high) { // Adds the unreduced 256-bit product, reduction is linear so it can wait
+        __m128i middle = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+
+        low = _mm_xor_si128(low, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00), _mm_slli_si128(middle, 8)));
+        high = _mm_xor_si128(high, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11), _mm_srli_si128(middle, 8)));
+    }
+
+    CPU_TARGET("pclmul,ssse3")
+    static __m128i reduce(__m128i low, __m128i high) { // Shifts the reflected product left by one then folds the top half back down
+        __m128i lowCarry = _mm_srli_epi32(low, 31);
+        __m128i highCarry = _mm_srli_epi32(high, 31);
+
+        low = _mm_slli_epi32(low, 1);
+        high = _mm_slli_epi32(high, 1);
+
+        __m128i crossCarry = _mm_srli_si128(lowCarry, 12);
+        highCarry = _mm_slli_si128(highCarry, 4);
+        lowCarry = _mm_slli_si128(lowCarry, 4);
+
+        low = _mm_or_si128(low, lowCarry);
+        high = _mm_or_si128(_mm_or_si128(high, highCarry), crossCarry);
+
+        __m128i fold = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)), _mm_slli_epi32(low, 25));
+        __m128i foldHigh = _mm_srli_si128(fold, 4);
+
+        low = _mm_xor_si128(low, _mm_slli_si128(fold, 12));
+
+        __m128i shifted = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)), _mm_srli_epi32(low, 7));
+
+        return _mm_xor_si128(high, _mm_xor_si128(low, _mm_xor_si128(shifted, foldHigh)));
+    }
+
+    CPU_TARGET("pclmul,ssse3")
+    static __m128i multiplyClmul(__m128i a, __m128i b) {
+        __m128i low = _mm_setzero_si128();
+        __m128i high = _mm_setzero_si128();
+
+        multiplyAccumulate(a, b, low, high);
+
+        return reduce(low, high);
+    }
+
+    CPU_TARGET("pclmul,ssse3")
+    void generatePowers(const Bytes& hashKey) {
+        hPowers[0] = byteSwap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hashKey.data())));
+
+        for (int i = 1; i < 4; i++) {
+            hPowers[i] = multiplyClmul(hPowers[i - 1], hPowers[0]);
+        }
+    }
+
+    CPU_TARGET("pclmul,ssse3")
+    void hashBlocksClmul(const uint8_t* data, size_t count) {
+        __m128i y = byteSwap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state.data())));
+        size_t b = 0;
+
+        for (; b + 4 <= count; b += 4) { // Y = (Y + X0)H^4 + X1 H^3 + X2 H^2 + X3 H
+            __m128i low = _mm_setzero_si128();
+            __m128i high = _mm_setzero_si128();
+
+            for (int i = 0; i < 4; i++) {
+                __m128i x = byteSwap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + (b + i) * blockSize)));
+                if (i == 0) x = _mm_xor_si128(x, y);
+
+                multiplyAccumulate(x, hPowers[3 - i], low, high);
+            }
+
+            y = reduce(low, high);
+        }
+
+        for (; b < count; b++) {
+            __m128i x = byteSwap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + b * blockSize)));
+
+            y = multiplyClmul(_mm_xor_si128(y, x), hPowers[0]);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state.data()), byteSwap(y));
+    }
+#endif
+
+    void hashBlocks(const uint8_t* data, size_t count) {
+#if CPU_X86
+        if (useClmul) {
+            hashBlocksClmul(data, count);
+
+            return;
+        }
+#endif
+        hashBlocksTable(data, count);
+    }
+
+public:
+    explicit GHash(const Bytes& hashKey, bool allowClmul = true) {
+#if CPU_X86
+        useClmul = allowClmul && CpuFeatures::get().hasPCLMUL() && CpuFeatures::get().hasSSSE3();
+
+        if (useClmul) generatePowers(hashKey);
+#endif
+        if (!useClmul) generateTables(hashKey);
+    }
+
+    bool usesClmul() const {
+        return useClmul;
+    }
+
+    void update(const uint8_t* data, size_t length) {
+        if (partialLength > 0) {
+            size_t taken = std::min(blockSize - partialLength, length);
+
+            std::memcpy(partial.data() + partialLength, data, taken);
+            partialLength += taken;
+            data += taken;
+            length -= taken;
+
+            if (partialLength < blockSize) return;
+
+            hashBlocks(partial.data(), 1);
+            partialLength = 0;
+        }
+
+        size_t count = length / blockSize;
+
+        hashBlocks(data, count);
+
+        partialLength = length - count * blockSize;
+        std::memcpy(partial.data(), data + count * blockSize, partialLength);
+    }
+
+    void pad() { // Zero fills an unfinished block, GCM pads the associated data and the ciphertext separately
+        if (partialLength == 0) return;
+
+        std::fill(partial.begin() + partialLength, partial.end(), 0);
+        hashBlocks(partial.data(), 1);
+        partialLength = 0;
+    }
+
+    Bytes finish(uint64_t aadLength, uint64_t textLength) { // Lengths in bytes, hashed as bit counts
+        Bytes lengths;
+
+        pad();
+        storeBigEndian(lengths.data(), aadLength * 8);
+        storeBigEndian(lengths.data() + 8, textLength * 8);
+        hashBlocks(lengths.data(), 1);
+
+        return state;
+    }
+};
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include "sha256.hpp"
+
+// Password based key derivation. PBKDF2-HMAC-SHA256 (RFC 8018) costs time only, scrypt (RFC 7914) also needs 128 * r * N bytes
+// of memory per derivation, which makes guessing on GPUs and custom hardware far more expensive.
+
+enum class KdfAlgorithm : uint8_t {
+    None = 0, // The password is the raw key, as in files from before key derivation
+    PBKDF2 = 1,
+    Scrypt = 2
+};
+
+struct KdfParameters {
+    static constexpr size_t saltLength = 16;
+    static constexpr size_t encodedLength = 8; // Cost fields as stored in the file header, the salt is stored separately
+    static constexpr size_t maxScryptMemory = size_t(1) << 30; // Refuses headers that would need more, so a corrupt file can't exhaust memory
+
+    KdfAlgorithm algorithm = KdfAlgorithm::PBKDF2;
+    std::array<uint8_t, saltLength> salt{};
+    uint32_t iterations = 600000; // PBKDF2
+    uint8_t scryptLogN = 17; // scrypt, N = 2^logN
+    uint8_t scryptR = 8;
+    uint8_t scryptP = 1;
+
+    size_t scryptMemory() const {
+        return size_t(128) * scryptR * (size_t(1) << scryptLogN);
+    }
+
+    void validate() const {
+        if (algorithm == KdfAlgorithm::PBKDF2 && iterations == 0) {
+            throw std::invalid_argument("PBKDF2 needs at least one iteration");
+        }
+
+        if (algorithm == KdfAlgorithm::Scrypt && (scryptLogN == 0 || scryptLogN >= 32 || scryptR == 0 || scryptP == 0 || scryptMemory() > maxScryptMemory)) {
+            throw std::invalid_argument("Unsupported scrypt parameters");
+        }
+
+        if (algorithm > KdfAlgorithm::Scrypt) {
+            throw std::invalid_argument("Unknown key derivation function");
+        }
+    }
+
+    std::array<uint8_t, encodedLength> encode() const { // Iteration count (big endian), log2 N, r, p, reserved byte
+        return {static_cast<uint8_t>(iterations >> 24), static_cast<uint8_t>(iterations >> 16), static_cast<uint8_t>(iterations >> 8), static_cast<uint8_t>(iterations),
+                scryptLogN, scryptR, scryptP, 0};
+    }
+
+    static KdfParameters decode(KdfAlgorithm algorithm, const uint8_t* salt, const uint8_t* encoded) {
+        KdfParameters parameters;
+        parameters.algorithm = algorithm;
+        std::copy_n(salt, saltLength, parameters.salt.begin());
+        parameters.iterations = Sha256::loadBigEndian(encoded);
+        parameters.scryptLogN = encoded[4];
+        parameters.scryptR = encoded[5];
+        parameters.scryptP = encoded[6];
+
+        return parameters;
+    }
+
+    std::string keyId() const { // Identifies the derived key for caches, equal settings and salt give equal keys
+        std::array<uint8_t, encodedLength> encoded = encode();
+        std::string key(1, static_cast<char>(algorithm));
+
+        key.append(reinterpret_cast<const char*>(salt.data()), salt.size());
+        key.append(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+
+        return key;
+    }
+};
+
+// HMAC-SHA256 with the padded key blocks hashed up front, every message after that costs two compressions fewer
+class HmacSha256 {
+    Sha256::State innerState = Sha256::initialState;
+    Sha256::State outerState = Sha256::initialState;
+
+public:
+    explicit HmacSha256(const std::string& key) {
+        std::array<uint8_t, Sha256::blockSize> innerPad{};
+        std::array<uint8_t, Sha256::blockSize> outerPad{};
+
+        if (key.size() > Sha256::blockSize) {
+            Sha256::Digest keyDigest = Sha256::hash(key.data(), key.size());
+            std::copy(keyDigest.begin(), keyDigest.end(), innerPad.begin());
+        } else {
+            std::copy(key.begin(), key.end(), innerPad.begin());
+        }
+
+        outerPad = innerPad;
+
+        for (size_t i = 0; i < Sha256::blockSize; i++) {
+            innerPad[i] ^= 0x36;
+            outerPad[i] ^= 0x5C;
+        }
+
+        Sha256::compress(innerState, innerPad.data(), 1);
+        Sha256::compress(outerState, outerPad.data(), 1);
+    }
+
+    const Sha256::State& getInnerState() const {
+        return innerState;
+    }
+
+    const Sha256::State& getOuterState() const {
+        return outerState;
+    }
+
+    Sha256::Digest mac(const void* data, size_t length) const {
+        Sha256 inner(innerState, Sha256::blockSize);
+        inner.update(data, length);
+        Sha256::Digest innerDigest = inner.finish();
+
+        Sha256 outer(outerState, Sha256::blockSize);
+        outer.update(innerDigest.data(), innerDigest.size());
+
+        return outer.finish();
+    }
+};
+
+class Kdf {
+    static constexpr uint32_t chainedBitLength = (Sha256::blockSize + Sha256::digestSize) * 8; // Every iteration after the first hashes one padded digest after a key block
+
+    static Sha256::Digest firstIteration(const HmacSha256& hmac, const uint8_t* salt, size_t saltLength, uint32_t blockIndex) { // U1 = HMAC(P, S || INT(i))
+        std::vector<uint8_t> message(salt, salt + saltLength);
+
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            message.push_back(static_cast<uint8_t>(blockIndex >> shift));
+        }
+
+        return hmac.mac(message.data(), message.size());
+    }
+
+    static void pbkdf2Block(const HmacSha256& hmac, const uint8_t* salt, size_t saltLength, uint32_t iterations, uint32_t blockIndex, uint8_t* output) { // One chain, latency bound so it runs on the SHA extensions when present
+        Sha256::Digest u = firstIteration(hmac, salt, saltLength, blockIndex);
+        std::array<uint8_t, Sha256::blockSize> block{}; // U followed by its padding, the compressions rewrite the first half in place
+        Sha256::State sum;
+
+        std::copy(u.begin(), u.end(), block.begin());
+        block[Sha256::digestSize] = 0x80;
+        Sha256::storeBigEndian(block.data() + Sha256::blockSize - 4, chainedBitLength);
+
+        for (int i = 0; i < 8; i++) sum[i] = Sha256::loadBigEndian(u.data() + i * 4);
+
+        for (uint32_t iteration = 1; iteration < iterations; iteration++) {
+            Sha256::State state = hmac.getInnerState();
+            Sha256::compress(state, block.data(), 1);
+            for (int i = 0; i < 8; i++) Sha256::storeBigEndian(block.data() + i * 4, state[i]);
+
+            state = hmac.getOuterState();
+            Sha256::compress(state, block.data(), 1);
+            for (int i = 0; i < 8; i++) Sha256::storeBigEndian(block.data() + i * 4, state[i]);
+
+            for (int i = 0; i < 8; i++) sum[i] ^= state[i];
+        }
+
+        Sha256::Digest digest = Sha256::digestFromState(sum);
+        std::copy(digest.begin(), digest.end(), output);
+    }
+
+    static void pbkdf2Lanes(const HmacSha256& hmac, const uint8_t* salt, size_t saltLength, uint32_t iterations, uint32_t firstBlock, size_t count, uint8_t* output) { // Up to eight chains at once, one per SIMD lane
+        Sha256::LaneWords message{};
+        Sha256::LaneState state;
+        uint32_t sum[8][Sha256::laneCount] = {};
+
+        for (size_t lane = 0; lane < count; lane++) {
+            Sha256::Digest u = firstIteration(hmac, salt, saltLength, firstBlock + lane);
+
+            for (int i = 0; i < 8; i++) message[i][lane] = sum[i][lane] = Sha256::loadBigEndian(u.data() + i * 4);
+        }
+
+        for (size_t lane = 0; lane < Sha256::laneCount; lane++) {
+            message[8][lane] = 0x80000000;
+            message[15][lane] = chainedBitLength;
+        }
+
+        auto compressFrom = [&](const Sha256::State& start) {
+            for (int i = 0; i < 8; i++) std::fill_n(state[i], Sha256::laneCount, start[i]);
+
+            Sha256::compressLanes(state, message);
+
+            for (int i = 0; i < 8; i++) std::copy_n(state[i], Sha256::laneCount, message[i]);
+        };
+
+        for (uint32_t iteration = 1; iteration < iterations; iteration++) {
+            compressFrom(hmac.getInnerState());
+            compressFrom(hmac.getOuterState());
+
+            for (int i = 0; i < 8; i++) {
+                for (size_t lane = 0; lane < Sha256::laneCount; lane++) sum[i][lane] ^= state[i][lane];
+            }
+        }
+
+        for (size_t lane = 0; lane < count; lane++) {
+            for (int i = 0; i < 8; i++) Sha256::storeBigEndian(output + lane * Sha256::digestSize + i * 4, sum[i][lane]);
+        }
+    }
+
+    static uint32_t loadLittleEndian(const uint8_t* bytes) {
+        return bytes[0] | static_cast<uint32_t>(bytes[1]) << 8 | static_cast<uint32_t>(bytes[2]) << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+    }
+
+    static void storeLittleEndian(uint8_t* bytes, uint32_t value) {
+        for (int i = 0; i < 4; i++) bytes[i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+
+    static constexpr uint32_t rotateLeft(uint32_t value, int count) {
+        return (value << count) | (value >> (32 - count));
+    }
+
+    static void salsa20_8(uint32_t* block) { // Salsa20 core reduced to 8 rounds, the mixing function of scrypt
+        uint32_t x[16];
+        std::copy_n(block, 16, x);
+
+        for (int round = 0; round < 8; round += 2) {
+            x[4] ^= rotateLeft(x[0] + x[12], 7);    x[8] ^= rotateLeft(x[4] + x[0], 9);
+            x[12] ^= rotateLeft(x[8] + x[4], 13);   x[0] ^= rotateLeft(x[12] + x[8], 18);
+            x[9] ^= rotateLeft(x[5] + x[1], 7);     x[13] ^= rotateLeft(x[9] + x[5], 9);
+            x[1] ^= rotateLeft(x[13] + x[9], 13);   x[5] ^= rotateLeft(x[1] + x[13], 18);
+            x[14] ^= rotateLeft(x[10] + x[6], 7);   x[2] ^= rotateLeft(x[14] + x[10], 9);
+            x[6] ^= rotateLeft(x[2] + x[14], 13);   x[10] ^= rotateLeft(x[6] + x[2], 18);
+            x[3] ^= rotateLeft(x[15] + x[11], 7);   x[7] ^= rotateLeft(x[3] + x[15], 9);
+            x[11] ^= rotateLeft(x[7] + x[3], 13);   x[15] ^= rotateLeft(x[11] + x[7], 18);
+
+            x[1] ^= rotateLeft(x[0] + x[3], 7);     x[2] ^= rotateLeft(x[1] + x[0], 9);
+            x[3] ^= rotateLeft(x[2] + x[1], 13);    x[0] ^= rotateLeft(x[3] + x[2], 18);
+            x[6] ^= rotateLeft(x[5] + x[4], 7);     x[7] ^= rotateLeft(x[6] + x[5], 9);
+            x[4] ^= rotateLeft(x[7] + x[6], 13);    x[5] ^= rotateLeft(x[4] + x[7], 18);
+            x[11] ^= rotateLeft(x[10] + x[9], 7);   x[8] ^= rotateLeft(x[11] + x[10], 9);
+            x[9] ^= rotateLeft(x[8] + x[11], 13);   x[10] ^= rotateLeft(x[9] + x[8], 18);
+            x[12] ^= rotateLeft(x[15] + x[14], 7);  x[13] ^= rotateLeft(x[12] + x[15], 9);
+            x[14] ^= rotateLeft(x[13] + x[12], 13); x[15] ^= rotateLeft(x[14] + x[13], 18);
+        }
+
+        for (int i = 0; i < 16; i++) block[i] += x[i];
+    }
+
+    static void blockMix(const uint32_t* input, uint32_t* output, size_t r) { // 2r Salsa blocks chained, even results to the first half of the output and odd to the second
+        uint32_t x[16];
+        std::copy_n(input + (2 * r - 1) * 16, 16, x);
+
+        for (size_t i = 0; i < 2 * r; i++) {
+            for (int j = 0; j < 16; j++) x[j] ^= input[i * 16 + j];
+
+            salsa20_8(x);
+            std::copy_n(x, 16, output + (i % 2 * r + i / 2) * 16);
+        }
+    }
+
+    static void roMix(uint8_t* bytes, size_t r, uint64_t n, std::vector<uint32_t>& memory) { // Fills memory with n successive mixes, then revisits them in a data dependent order
+        size_t words = 32 * r;
+        std::vector<uint32_t> x(words), y(words);
+
+        for (size_t i = 0; i < words; i++) x[i] = loadLittleEndian(bytes + i * 4);
+
+        for (uint64_t i = 0; i < n; i++) {
+            std::copy(x.begin(), x.end(), memory.begin() + i * words);
+            blockMix(x.data(), y.data(), r);
+            x.swap(y);
+        }
+
+        for (uint64_t i = 0; i < n; i++) {
+            uint64_t j = (x[words - 16] | static_cast<uint64_t>(x[words - 15]) << 32) & (n - 1); // Integerify, n is a power of two
+
+            for (size_t k = 0; k < words; k++) x[k] ^= memory[j * words + k];
+
+            blockMix(x.data(), y.data(), r);
+            x.swap(y);
+        }
+
+        for (size_t i = 0; i < words; i++) storeLittleEndian(bytes + i * 4, x[i]);
+    }
+
+public:
+    static std::vector<uint8_t> pbkdf2(const std::string& password, const uint8_t* salt, size_t saltLength, uint32_t iterations, size_t length) {
+        if (iterations == 0) {
+            throw std::invalid_argument("PBKDF2 needs at least one iteration");
+        }
+
+        HmacSha256 hmac(password);
+        size_t blockCount = (length + Sha256::digestSize - 1) / Sha256::digestSize;
+        std::vector<uint8_t> output(blockCount * Sha256::digestSize);
+
+        bool useLanes = blockCount > 1 && !Sha256::hasHardwareSupport() && Sha256::hasLaneSupport(); // One SHA-NI chain is still faster than a lane of AVX2
+
+        for (size_t block = 0; block < blockCount;) {
+            if (useLanes) {
+                size_t count = std::min(Sha256::laneCount, blockCount - block);
+
+                pbkdf2Lanes(hmac, salt, saltLength, iterations, block + 1, count, output.data() + block * Sha256::digestSize);
+                block += count;
+            } else {
+                pbkdf2Block(hmac, salt, saltLength, iterations, block + 1, output.data() + block * Sha256::digestSize);
+                block++;
+            }
+        }
+
+        output.resize(length);
+
+        return output;
+    }
+
+    static std::vector<uint8_t> scrypt(const std::string& password, const uint8_t* salt, size_t saltLength, unsigned logN, size_t r, size_t p, size_t length) {
+        uint64_t n = uint64_t(1) << logN;
+        std::vector<uint8_t> blocks = pbkdf2(password, salt, saltLength, 1, p * 128 * r);
+        std::vector<uint32_t> memory(n * 32 * r);
+
+        for (size_t i = 0; i < p; i++) {
+            roMix(blocks.data() + i * 128 * r, r, n, memory);
+        }
+
+        return pbkdf2(password, blocks.data(), blocks.size(), 1, length);
+    }
+
+    static std::vector<uint8_t> derive(const std::string& password, const KdfParameters& parameters, size_t length) {
+        parameters.validate();
+
+        switch (parameters.algorithm) {
+            case KdfAlgorithm::PBKDF2:
+                return pbkdf2(password, parameters.salt.data(), parameters.salt.size(), parameters.iterations, length);
+            case KdfAlgorithm::Scrypt:
+                return scrypt(password, parameters.salt.data(), parameters.salt.size(), parameters.scryptLogN, parameters.scryptR, parameters.scryptP, length);
+            default:
+                throw std::invalid_argument("Key derivation function has no derivation step");
+        }
+    }
+
+    static KdfParameters calibrate(KdfParameters parameters, double targetSeconds) { // Times growing trial runs until one is long enough to measure, then scales the cost to the target
+        if (parameters.algorithm == KdfAlgorithm::None) return parameters;
+
+        bool scrypt = parameters.algorithm == KdfAlgorithm::Scrypt;
+        KdfParameters trial = parameters;
+
+        if (scrypt) trial.scryptLogN = 10;
+        else trial.iterations = 1000;
+
+        for (;;) {
+            auto start = std::chrono::steady_clock::now();
+            derive("calibration", trial, 32);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (scrypt) { // Cost doubles with each step of log2 N, so step up until the next one would overshoot
+                KdfParameters next = trial;
+                next.scryptLogN++;
+
+                if (seconds * 2 > targetSeconds || next.scryptMemory() > KdfParameters::maxScryptMemory) {
+                    parameters.scryptLogN = trial.scryptLogN;
+
+                    return parameters;
+                }
+
+                trial = next;
+            } else if (seconds >= 0.05 || trial.iterations >= (1u << 30)) {
+                double iterations = trial.iterations * targetSeconds / seconds;
+                parameters.iterations = static_cast<uint32_t>(std::clamp(iterations, 1.0, 4294967295.0));
+
+                return parameters;
+            } else {
+                trial.iterations *= 4;
+            }
+        }
+    }
+};
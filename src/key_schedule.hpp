@@ -1,26 +1,48 @@
 #pragma once
 
 #include <array>
+#include <string>
 #include <ostream>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
 
 #include "substitution_box.hpp"
 #include "vector.hpp"
+#include "matrix.hpp"
 #include "block.hpp"
 
 template <size_t cols, size_t rows>
 class Block;
 
+constexpr size_t roundConstantCount(size_t cols, size_t keyWordCount, size_t rounds) { // One per key length of expanded words after the first, 10 for AES-128 but 29 for 256-bit blocks under a 128-bit key
+    return ((rounds + 1) * cols - 1) / keyWordCount;
+}
+
+// Round keys expanded from a cipher key. Built with the inverse mix columns matrix it also holds the equivalent inverse cipher keys,
+// so decryption can fuse its mix columns step into the table lookups without transforming round keys per block.
+// serialize writes the expanded keys in a compact binary form: magic "DIYK", version, cols, rows, rounds, flags, then the key bytes.
 template <size_t cols, size_t rows, size_t rounds>
 class KeySchedule {
+    static constexpr std::array<char, 4> serialMagic = {'D', 'I', 'Y', 'K'};
+    static constexpr uint8_t serialVersion = 1;
+    static constexpr size_t serialHeaderSize = 9;
+    static constexpr size_t keyBytes = (rounds + 1) * cols * rows;
+
     std::array<Block<cols, rows>, rounds + 1> roundKeys;
+    std::array<Block<cols, rows>, rounds + 1> inverseRoundKeys; // In decryption order, the middle rounds passed through the inverse mix columns matrix
+    bool inverseKeys = false;
+
+    KeySchedule() = default;
 
     Vector<rows>& getWord(size_t wordIndex) {
         return roundKeys[wordIndex / cols][wordIndex % cols];
     }
 
-public:
-    template <size_t keyWordCount>
-    KeySchedule(const Block<keyWordCount, rows>& key, const SubstitutionBox& subBox, const std::array<GF256, rounds>& roundConstants) {
+    template <size_t keyWordCount, size_t constantCount>
+    void expand(const Block<keyWordCount, rows>& key, const SubstitutionBox& subBox, const std::array<GF256, constantCount>& roundConstants) {
+        static_assert(constantCount >= roundConstantCount(cols, keyWordCount, rounds), "Not enough round constants for this key and block size");
+
         size_t totalWords = (rounds + 1) * cols;
         size_t currentWord = 0;
 
@@ -37,18 +59,110 @@ public:
                 intermediateWord.rotWord();
                 intermediateWord.subWord(subBox);
                 intermediateWord.applyConstant(roundConstants[currentWord / keyWordCount - 1]);
+            } else if (keyWordCount > 6 && currentWord % keyWordCount == 4) { // Keys of more than 6 words get a second substitution half way, AES-256 and wider
+                intermediateWord.subWord(subBox);
             }
 
             word = aboveWord + intermediateWord;
         }
     }
 
+    void deriveInverseKeys(const Matrix<rows>& mixColMatrixInv) {
+        inverseRoundKeys[0] = roundKeys[rounds];
+        inverseRoundKeys[rounds] = roundKeys[0];
+
+        for (size_t n = 1; n < rounds; n++) {
+            inverseRoundKeys[n] = roundKeys[rounds - n];
+            inverseRoundKeys[n].mixColumns(mixColMatrixInv);
+        }
+
+        inverseKeys = true;
+    }
+
+    static void appendBlock(std::string& bytes, const Block<cols, rows>& block) {
+        for (size_t c = 0; c < cols; c++) {
+            for (size_t r = 0; r < rows; r++) {
+                bytes += static_cast<char>(block[c][r].get());
+            }
+        }
+    }
+
+    static void readBlock(Block<cols, rows>& block, const char* bytes) {
+        for (size_t c = 0; c < cols; c++) {
+            for (size_t r = 0; r < rows; r++) {
+                block[c][r] = static_cast<uint8_t>(bytes[c * rows + r]);
+            }
+        }
+    }
+
+public:
+    template <size_t keyWordCount, size_t constantCount>
+    KeySchedule(const Block<keyWordCount, rows>& key, const SubstitutionBox& subBox, const std::array<GF256, constantCount>& roundConstants) {
+        expand(key, subBox, roundConstants);
+    }
+
+    template <size_t keyWordCount, size_t constantCount>
+    KeySchedule(const Block<keyWordCount, rows>& key, const SubstitutionBox& subBox, const std::array<GF256, constantCount>& roundConstants, const Matrix<rows>& mixColMatrixInv) { // Both directions expanded once up front
+        expand(key, subBox, roundConstants);
+        deriveInverseKeys(mixColMatrixInv);
+    }
+
     const Block<cols, rows>& getRoundKey(size_t round) const {
         return roundKeys[round];
     }
 
+    bool hasInverseKeys() const {
+        return inverseKeys;
+    }
+
+    const Block<cols, rows>& getInverseRoundKey(size_t step) const { // Key added after decryption step, step 0 being the initial key addition
+        return inverseRoundKeys[step];
+    }
+
+    std::string serialize() const { // Raw key material, store it only where the cipher key itself could be stored
+        std::string bytes(serialMagic.begin(), serialMagic.end());
+
+        bytes += static_cast<char>(serialVersion);
+        bytes += static_cast<char>(cols);
+        bytes += static_cast<char>(rows);
+        bytes += static_cast<char>(rounds);
+        bytes += static_cast<char>(inverseKeys ? 1 : 0);
+
+        for (const Block<cols, rows>& roundKey : roundKeys) appendBlock(bytes, roundKey);
+        if (inverseKeys) for (const Block<cols, rows>& roundKey : inverseRoundKeys) appendBlock(bytes, roundKey);
+
+        return bytes;
+    }
+
+    static KeySchedule deserialize(const std::string& bytes) {
+        if (bytes.size() < serialHeaderSize || !std::equal(serialMagic.begin(), serialMagic.end(), bytes.begin()) || static_cast<uint8_t>(bytes[4]) != serialVersion) {
+            throw std::runtime_error("Not a serialized key schedule");
+        }
+
+        if (static_cast<uint8_t>(bytes[5]) != cols || static_cast<uint8_t>(bytes[6]) != rows || static_cast<uint8_t>(bytes[7]) != rounds) {
+            throw std::runtime_error("Serialized key schedule has different cipher dimensions");
+        }
+
+        KeySchedule keySchedule;
+        keySchedule.inverseKeys = bytes[8] & 1;
+
+        if (bytes.size() != serialHeaderSize + keyBytes * (keySchedule.inverseKeys ? 2 : 1)) {
+            throw std::runtime_error("Serialized key schedule has the wrong length");
+        }
+
+        const char* keyData = bytes.data() + serialHeaderSize;
+
+        for (size_t n = 0; n <= rounds; n++) {
+            readBlock(keySchedule.roundKeys[n], keyData + n * cols * rows);
+
+            if (keySchedule.inverseKeys) readBlock(keySchedule.inverseRoundKeys[n], keyData + keyBytes + n * cols * rows);
+        }
+
+        return keySchedule;
+    }
+
     void print(std::ostream& stream, GFFormat format = GFFormat::Hex) const {
-        for (int r = 0; r < rounds; r++) {
+        for (int r = 0; r <= rounds; r++) {
             if (r > 0) stream << '\n';
 
             stream << "Round " << r << ":\n";
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <utility>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+
+// Thread safe map holding at most capacity entries, inserting into a full cache evicts the entry used longest ago.
+// Values are returned by copy, so they should be cheap handles such as shared pointers.
+template <typename Key, typename Value>
+class LruCache {
+    using Entry = std::pair<Key, Value>;
+
+    size_t capacity;
+    std::list<Entry> entries; // Most recently used first
+    std::unordered_map<Key, typename std::list<Entry>::iterator> index;
+    mutable std::mutex mutex;
+
+    void evict() {
+        while (entries.size() > capacity) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+public:
+    explicit LruCache(size_t capacity) : capacity(capacity) {
+        if (capacity == 0) {
+            throw std::invalid_argument("Cache capacity must be at least 1");
+        }
+    }
+
+    std::optional<Value> get(const Key& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(key);
+
+        if (found == index.end()) return std::nullopt;
+
+        entries.splice(entries.begin(), entries, found->second); // Moves the node to the front without invalidating the iterator in the index
+
+        return found->second->second;
+    }
+
+    void put(const Key& key, Value value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(key);
+
+        if (found != index.end()) {
+            found->second->second = std::move(value);
+            entries.splice(entries.begin(), entries, found->second);
+
+            return;
+        }
+
+        entries.emplace_front(key, std::move(value));
+        index[key] = entries.begin();
+        evict();
+    }
+
+    template <typename Factory>
+    Value getOrInsert(const Key& key, Factory&& create) { // create runs under the lock, so it should only make a handle and leave slow work to the caller
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(key);
+
+        if (found != index.end()) {
+            entries.splice(entries.begin(), entries, found->second);
+
+            return found->second->second;
+        }
+
+        entries.emplace_front(key, create());
+        index[key] = entries.begin();
+        Value value = entries.front().second;
+        evict();
+
+        return value;
+    }
+
+    bool erase(const Key& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(key);
+
+        if (found == index.end()) return false;
+
+        entries.erase(found->second);
+        index.erase(found);
+
+        return true;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        return entries.size();
+    }
+};
@@ -1,150 +1,272 @@
 #include <iostream>
-#include <fstream>
 #include <filesystem>
 #include <string>
-#include <array>
 #include <vector>
-#include <ostream>
+#include <chrono>
+#include <fstream>
 
-#include "gf256.hpp"
-#include "vector.hpp"
-#include "matrix.hpp"
 #include "block.hpp"
-#include "block_string.hpp"
 #include "key_schedule.hpp"
-#include "substitution_box.hpp"
+#include "cipher_parameters.hpp"
+#include "cipher_variant.hpp"
+#include "file_crypt.hpp"
+#include "self_test.hpp"
+#include "kdf.hpp"
+#include "password_keys.hpp"
+#include "daemon.hpp"
+#include "thread_pool.hpp"
+#include "stats.hpp"
+
+void writeReport(const std::string& path, const std::string& contents) { // "-" prints it, files are replaced by rename so a collector never reads half a report
+    if (path == "-") {
+        std::cout << contents << std::flush;
+
+        return;
+    }
 
-constexpr size_t cols = 4;
-constexpr size_t rows = 4;
-constexpr size_t blockSize = cols * rows;
+    std::string tempPath = path + tempExtension;
 
-constexpr size_t keyWordCount = 4; // 4, 6, 8
-constexpr size_t keySize = keyWordCount * rows;
+    {
+        std::ofstream file(tempPath, std::ios::binary);
+        file << contents;
 
-constexpr size_t rounds = 10; // 10, 12, 14
+        if (!file) {
+            throw std::ios_base::failure("Failed to write to file: " + tempPath);
+        }
+    }
 
-constexpr std::array<GF256, rounds> roundConstants = []() constexpr {
-    std::array<GF256, rounds> constants{};
-    GF256 constant = 1;
+    renameFile(tempPath, path);
+}
 
-    for (int i = 0; i < rounds; i++) {
-        constants[i] = constant;
-        constant *= 2;
+int main(int argc, char *argv[]) {
+    if (mixColMatrixInv.isSingular()) {
+        throw std::runtime_error("Mix columns matrix is singular, no inverse exists.");
     }
 
-    return constants;
-}();
-
-constexpr SubstitutionBox subBox;
+    std::vector<std::string> paths;
+    size_t threadCount = ThreadPool::defaultThreadCount();
+    EncryptionOptions encryption; // Only used for encryption, decryption reads the mode and chunk size from the file header
+    FileIoOptions io;
+    bool validArguments = true;
+
+    KdfParameters kdf; // Only used for encryption, decryption reads the settings and salt from the file header
+    double kdfSeconds = 0; // When set, the KDF cost is calibrated to take about this long on this machine
+    bool calibrateOnly = false;
+    std::string socketPath; // Daemon mode when set
+    bool rangeRead = false; // Prints rangeLength decrypted bytes from rangeOffset of a chunked file instead of decrypting all of it
+    uint64_t rangeOffset = 0;
+    uint64_t rangeLength = 0;
+
+    bool statsText = false;
+    std::string statsJsonPath; // Reports written after the run, any of the three turns collection on
+    std::string statsPrometheusPath;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--threads" && i + 1 < argc) {
+            threadCount = std::stoul(argv[++i]);
+
+            if (threadCount == 0) {
+                throw std::invalid_argument("Thread count must be at least 1");
+            }
+        } else if (arg == "--self-test") {
+            return SelfTest(std::cout).run() ? 0 : 1;
+        } else if (arg == "--daemon" && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (arg == "--mmap") {
+            io.method = IoMethod::Mmap;
+        } else if (arg == "--io" && i + 1 < argc) {
+            std::string ioName = argv[++i];
+
+            if (ioName == "auto") io.method = IoMethod::Auto;
+            else if (ioName == "uring") io.method = IoMethod::Uring;
+            else if (ioName == "threads") io.method = IoMethod::Threads;
+            else if (ioName == "stream") io.method = IoMethod::Stream;
+            else if (ioName == "mmap") io.method = IoMethod::Mmap;
+            else throw std::invalid_argument("Unknown I/O method: " + ioName);
+        } else if (arg == "--direct") {
+            io.directIo = true;
+        } else if (arg == "--queue-depth" && i + 1 < argc) {
+            io.queueDepth = std::stoul(argv[++i]);
+        } else if (arg == "--stats") {
+            statsText = true;
+        } else if (arg == "--stats-json" && i + 1 < argc) {
+            statsJsonPath = argv[++i];
+        } else if (arg == "--stats-prometheus" && i + 1 < argc) {
+            statsPrometheusPath = argv[++i];
+        } else if (arg == "--mode" && i + 1 < argc) {
+            std::string modeName = argv[++i];
+
+            if (modeName == "cbc") encryption.mode = CipherMode::CBC;
+            else if (modeName == "ctr") encryption.mode = CipherMode::CTR;
+            else if (modeName == "gcm") encryption.mode = CipherMode::GCM;
+            else throw std::invalid_argument("Unknown mode: " + modeName);
+        } else if (arg == "--chunk-size" && i + 1 < argc) {
+            encryption.chunkSize = std::stoull(argv[++i]);
+
+            if (!validChunkSize(encryption.chunkSize)) {
+                throw std::invalid_argument("Chunk size must be 0 or a power of two from 4096 to 1073741824");
+            }
+        } else if (arg == "--key-size" && i + 1 < argc) {
+            encryption.variant = variantForKeyBits(std::stoul(argv[++i]));
+        } else if (arg == "--range" && i + 1 < argc) {
+            std::string range = argv[++i];
+            size_t colon = range.find(':');
+
+            if (colon == std::string::npos) {
+                throw std::invalid_argument("Range must be offset:length");
+            }
+
+            rangeRead = true;
+            rangeOffset = std::stoull(range.substr(0, colon));
+            rangeLength = std::stoull(range.substr(colon + 1));
+        } else if (arg == "--kdf" && i + 1 < argc) {
+            std::string kdfName = argv[++i];
+
+            if (kdfName == "pbkdf2") kdf.algorithm = KdfAlgorithm::PBKDF2;
+            else if (kdfName == "scrypt") kdf.algorithm = KdfAlgorithm::Scrypt;
+            else if (kdfName == "none") kdf.algorithm = KdfAlgorithm::None;
+            else throw std::invalid_argument("Unknown key derivation function: " + kdfName);
+        } else if (arg == "--kdf-iterations" && i + 1 < argc) {
+            kdf.iterations = std::stoul(argv[++i]);
+        } else if (arg == "--scrypt-cost" && i + 1 < argc) {
+            kdf.scryptLogN = static_cast<uint8_t>(std::stoul(argv[++i]));
+        } else if ((arg == "--kdf-time" || arg == "--calibrate") && i + 1 < argc) {
+            kdfSeconds = std::stod(argv[++i]) / 1000;
+            calibrateOnly = arg == "--calibrate";
+
+            if (kdfSeconds <= 0) {
+                throw std::invalid_argument("KDF time must be positive");
+            }
+        } else if (arg.rfind("--", 0) != 0) {
+            paths.push_back(arg);
+        } else {
+            validArguments = false;
+        }
+    }
 
-constexpr Matrix<rows> mixColMatrix = Matrix<rows>::createCirculantMatrix(Vector<rows>({2, 3, 1, 1}));
-constexpr Matrix<rows> mixColMatrixInv = mixColMatrix.inverse();
+    if (kdfSeconds > 0 && validArguments) {
+        kdf = Kdf::calibrate(kdf, kdfSeconds);
 
-const std::string encryptedExtension = ".enc";
-const std::string ivExtension = ".iv";
+        std::cout << "KDF cost for " << kdfSeconds * 1000 << " ms: "
+                  << (kdf.algorithm == KdfAlgorithm::Scrypt ? "--scrypt-cost " + std::to_string(kdf.scryptLogN) : "--kdf-iterations " + std::to_string(kdf.iterations)) << std::endl;
 
-std::string generateIV(size_t length) {
-    std::mt19937 gen(std::random_device{}());
-    std::uniform_int_distribution<> dist(0, 255);
+        if (calibrateOnly) return 0;
+    }
 
-    std::string iv(length, '\0');
+    if ((paths.empty() && socketPath.empty()) || (rangeRead && paths.size() != 1) || !validArguments) {
+        std::cerr << "Usage: " << argv[0] << " [--mode gcm|ctr|cbc] [--chunk-size bytes] [--key-size 128|192|256] [--kdf pbkdf2|scrypt|none] [--kdf-iterations N] [--scrypt-cost log2N] [--kdf-time ms] [--threads N] [--io auto|uring|threads|stream|mmap] [--direct] [--queue-depth N] [--stats] [--stats-json path|-] [--stats-prometheus path|-] <file or directory>...\n"
+                  << "       " << argv[0] << " --daemon <socket path> [--chunk-size bytes] [--key-size 128|192|256] [--kdf pbkdf2|scrypt|none] [--threads N] [--stats] [--stats-json path|-] [--stats-prometheus path|-]\n"
+                  << "       " << argv[0] << " --range offset:length <file.enc>\n"
+                  << "       " << argv[0] << " --calibrate ms [--kdf pbkdf2|scrypt]\n"
+                  << "       " << argv[0] << " --self-test" << std::endl;
 
-    for (size_t i = 0; i < length; i++) {
-        iv[i] = static_cast<char>(dist(gen));
+        return 1;
     }
 
-    return iv;
-}
-
-std::string readFile(std::string filePath) {
-    std::ifstream inFile(filePath, std::ios::binary | std::ios::ate);
+    kdf.validate();
 
-    if (!inFile) {
-        throw std::ios_base::failure("Failed to read from file: " + filePath);
+    if (encryption.variant != CipherVariant::Aes128 && encryption.chunkSize == 0) { // Checked here rather than failing every file of a batch
+        throw std::invalid_argument("192 and 256-bit keys need the chunked format, --chunk-size can't be 0");
     }
 
-    std::streamsize fileSize = inFile.tellg();
-    inFile.seekg(0);
+    auto reportStats = [&]() {
+        if (statsText) std::cerr << Stats::global().formatText();
+        if (!statsJsonPath.empty()) writeReport(statsJsonPath, Stats::global().formatJson());
+        if (!statsPrometheusPath.empty()) writeReport(statsPrometheusPath, Stats::global().formatPrometheus());
+    };
 
-    std::string fileData(fileSize, '\0');
-    inFile.read(fileData.data(), fileSize);
-    inFile.close();
+    if (statsText || !statsJsonPath.empty() || !statsPrometheusPath.empty()) Stats::global().enable();
 
-    return fileData;
-}
+    std::string salt = generateIV(KdfParameters::saltLength); // One salt for the whole run, so the key is derived once however many files there are
+    std::copy(salt.begin(), salt.end(), kdf.salt.begin());
 
-void writeToFile(std::string filePath, std::string data) {
-    std::ofstream outFile(filePath, std::ios::binary);
+    if (!socketPath.empty()) { // Keys stay resident for every request, so the password is asked for once
+        std::string password;
 
-    if (!outFile) {
-        throw std::ios_base::failure("Failed to write to file: " + filePath);
-    }
+        std::cout << "Starting daemon, input password: ";
+        std::cin >> password;
 
-    outFile.seekp(0);
-    outFile.write(data.data(), data.size());
-    outFile.close();
-}
+        if (password.empty()) {
+            throw std::invalid_argument("Password must not be empty");
+        }
 
-void renameFile(std::string filePath, std::string newPath) {
-    if (std::rename(filePath.c_str(), newPath.c_str()) != 0) {
-        throw std::runtime_error("Failed to rename file: " + filePath);
-    }
-}
+        PasswordKeys keys(password, kdf);
+        withCipherVariant(encryption.variant, [&](auto shape) { // Derives the encryption key before accepting requests, so the first one isn't slow
+            keys.get<decltype(shape)>(kdf);
+        });
 
-void deleteFile(std::string filePath) {
-    if (std::remove(filePath.c_str()) != 0) {
-        throw std::runtime_error("Failed to delete file: " + filePath);
-    }
-}
+        EncryptionDaemon daemon(socketPath, keys, encryption, threadCount);
 
-int main(int argc, char *argv[]) {
-    if (mixColMatrixInv.isSingular()) {
-        throw std::runtime_error("Mix columns matrix is singular, no inverse exists.");
+        std::cout << "\nListening on " << socketPath << std::endl;
+        daemon.run();
+        reportStats();
+
+        return 0;
     }
 
-    if (argc != 2) {
-        std::cerr << "Error";
+    if (rangeRead) { // Decrypted bytes go to stdout, so everything else goes to stderr
+        std::string password;
 
-        return 1;
-    }
+        std::cerr << "Reading range, input password: ";
+        std::cin >> password;
 
-    std::string filePath = argv[1];
-    std::string fileData = readFile(filePath);
+        PasswordKeys keys(password, kdf);
+        ChunkedFileReader reader(paths[0], keys);
+        std::string text = reader.read(rangeOffset, static_cast<size_t>(std::min<uint64_t>(rangeLength, reader.size())));
 
-    bool encrypted = std::filesystem::path(filePath).extension() == encryptedExtension;
+        std::cout.write(text.data(), text.size());
+        std::cout.flush();
+        reportStats();
 
-    std::string rootFilePath = encrypted ? filePath.substr(0, filePath.length() - encryptedExtension.size()) : filePath;
-    std::string ivPath = rootFilePath + ivExtension;
+        return 0;
+    }
 
-    std::string iv = encrypted ? readFile(ivPath) : generateIV(blockSize);
+    bool batch = paths.size() > 1 || std::filesystem::is_directory(paths[0]); // Files ending in .enc are decrypted, everything else is encrypted
+    std::vector<std::string> files = collectFiles(paths);
 
     std::string password;
-    std::cout << (encrypted ? "Decrypting" : "Encrypting") << " file, input password key: ";
+
+    if (batch) std::cout << "Processing " << files.size() << " files, input password: ";
+    else std::cout << (std::filesystem::path(files[0]).extension() == encryptedExtension ? "Decrypting" : "Encrypting") << " file, input password: ";
+
     std::cin >> password;
 
-    if (password.length() != keySize) {
-        throw std::invalid_argument("Key does not match required length of " + std::to_string(keySize));
+    if (password.empty()) {
+        throw std::invalid_argument("Password must not be empty");
     }
 
-    Block<cols, rows> ivBlock = Block<cols, rows>::fromString(iv);
-    Block<keyWordCount, rows> key = Block<keyWordCount, rows>::fromString(password);
+    PasswordKeys keys(password, kdf); // Derives each distinct key once and shares it between files
+    ThreadPool pool(threadCount);
+
+    if (!batch) { // A single file spreads its own work over the pool instead
+        processFile(files[0], keys, encryption, io, &pool);
+        reportStats();
 
-    KeySchedule<cols, rows, rounds> keySchedule = KeySchedule<cols, rows, rounds>(key, subBox, roundConstants);
-    BlockString<cols, rows> blockString = BlockString<cols, rows>(fileData, encrypted);
+        return 0;
+    }
 
-    if (encrypted) blockString.cbcDecrypt(keySchedule, subBox, mixColMatrixInv, ivBlock);
-    else blockString.cbcEncrypt(keySchedule, subBox, mixColMatrix, ivBlock);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<FileResult> results = processFiles(files, keys, encryption, io, pool);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-    std::string newData = blockString.getText(encrypted);
+    uint64_t totalBytes = 0;
+    size_t failed = 0;
 
-    writeToFile(filePath, newData);
-    renameFile(filePath, encrypted ? rootFilePath : rootFilePath + encryptedExtension);
+    for (const FileResult& result : results) {
+        totalBytes += result.bytes;
 
-    if (encrypted) {
-        deleteFile(ivPath);
-    } else {
-        writeToFile(ivPath, iv);
+        if (!result.error.empty()) {
+            std::cerr << result.filePath << ": " << result.error << std::endl;
+            failed++;
+        }
     }
 
-    return 0;
-}
\ No newline at end of file
+    std::cout << "Processed " << results.size() - failed << " of " << results.size() << " files, " << totalBytes << " bytes in " << seconds << " s ("
+              << (seconds > 0 ? totalBytes / seconds / 1e6 : 0) << " MB/s)" << std::endl;
+
+    reportStats();
+
+    return failed == 0 ? 0 : 1;
+}
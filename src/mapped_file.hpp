@@ -0,0 +1,155 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <ios>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILES 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define MAPPED_FILES 0
+#endif
+
+// Read only mapping of a whole file, the pages are read straight by the cipher instead of copied through a stream buffer
+class MappedInputFile {
+    const char* data = nullptr;
+    size_t length = 0;
+
+public:
+    explicit MappedInputFile(const std::string& filePath) {
+#if MAPPED_FILES
+        int fd = open(filePath.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            throw std::ios_base::failure("Failed to read from file: " + filePath + " (" + std::strerror(errno) + ")");
+        }
+
+        struct stat info;
+
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+
+            throw std::ios_base::failure("Failed to read from file: " + filePath + " (" + std::strerror(errno) + ")");
+        }
+
+        length = info.st_size;
+
+        if (length > 0) { // Zero length mappings are an error, an empty file just has no data
+            void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (mapping == MAP_FAILED) {
+                close(fd);
+
+                throw std::ios_base::failure("Failed to map file: " + filePath + " (" + std::strerror(errno) + ")");
+            }
+
+            madvise(mapping, length, MADV_SEQUENTIAL); // Read ahead aggressively and drop pages once passed
+            data = static_cast<const char*>(mapping);
+        }
+
+        close(fd); // The mapping keeps its own reference to the file
+#else
+        throw std::runtime_error("Memory mapped files are not supported on this platform");
+#endif
+    }
+
+    MappedInputFile(const MappedInputFile&) = delete;
+    MappedInputFile& operator=(const MappedInputFile&) = delete;
+
+    ~MappedInputFile() {
+#if MAPPED_FILES
+        if (data != nullptr) munmap(const_cast<char*>(data), length);
+#endif
+    }
+
+    const char* getData() const {
+        return data;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
+
+// Writable shared mapping of a new file preallocated to its largest possible size, commit trims it to what was written and syncs it to disk
+class MappedOutputFile {
+    std::string filePath;
+    int fd = -1;
+    char* data = nullptr;
+    size_t capacity = 0;
+
+    void fail(const std::string& message) {
+        std::string reason = std::strerror(errno);
+
+        release();
+
+        throw std::ios_base::failure(message + filePath + " (" + reason + ")");
+    }
+
+    void release() {
+#if MAPPED_FILES
+        if (data != nullptr) munmap(data, capacity);
+        if (fd >= 0) close(fd);
+#endif
+        data = nullptr;
+        fd = -1;
+    }
+
+public:
+    MappedOutputFile(const std::string& filePath, size_t capacity) : filePath(filePath), capacity(capacity) {
+#if MAPPED_FILES
+        fd = open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+        if (fd < 0) fail("Failed to write to file: ");
+
+#if defined(__linux__)
+        if (capacity > 0 && fallocate(fd, 0, 0, capacity) != 0 && errno != EOPNOTSUPP) { // Reserves the blocks up front, so a full disk fails here instead of as SIGBUS on a store into the mapping
+            fail("Failed to reserve space for file: ");
+        }
+#endif
+
+        if (ftruncate(fd, capacity) != 0) fail("Failed to size file: ");
+
+        if (capacity > 0) {
+            void* mapping = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (mapping == MAP_FAILED) fail("Failed to map file: ");
+
+            madvise(mapping, capacity, MADV_SEQUENTIAL);
+            data = static_cast<char*>(mapping);
+        }
+#else
+        throw std::runtime_error("Memory mapped files are not supported on this platform");
+#endif
+    }
+
+    MappedOutputFile(const MappedOutputFile&) = delete;
+    MappedOutputFile& operator=(const MappedOutputFile&) = delete;
+
+    ~MappedOutputFile() {
+        release();
+    }
+
+    char* getData() {
+        return data;
+    }
+
+    void commit(size_t length) { // Must be called before the file is renamed into place, otherwise it may still hold unflushed pages
+#if MAPPED_FILES
+        if (data != nullptr && munmap(data, capacity) != 0) fail("Failed to unmap file: ");
+        data = nullptr;
+
+        if (ftruncate(fd, length) != 0) fail("Failed to size file: ");
+        if (fsync(fd) != 0) fail("Failed to sync file: ");
+
+        close(fd);
+        fd = -1;
+#endif
+    }
+};
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <span>
+#include <cstddef>
+
+#include "block.hpp"
+#include "key_schedule.hpp"
+#include "round_engine.hpp"
+#include "aes_ni.hpp"
+#include "cpu_features.hpp"
+
+// CBC encryption of many independent messages at once. One message is a serial chain, every block waits for the previous one's
+// full round latency, so on its own it keeps a single round unit busy. Interleaving a block from each of several messages per
+// step fills the pipeline the way independent blocks of CTR or CBC decryption already do.
+
+constexpr size_t multiBufferLanes = 8; // Chains in flight, matching the interleave of AesNiKeys
+
+template <size_t cols, size_t rows, size_t rounds>
+struct CbcJob {
+    const KeySchedule<cols, rows, rounds>* keySchedule; // Jobs may each have their own key
+    Block<cols, rows> chainBlock; // The IV going in, the last ciphertext block coming out, so a message can continue in a later call
+    std::span<Block<cols, rows>> blocks; // Padded plaintext, encrypted in place, BlockString::getBlocks() gives this
+};
+
+// Which job and block each lane is on. A lane whose job runs out of blocks takes the next job straight away, so short messages
+// never leave a lane idle while work is queued. Once the queue is empty, finished lanes are dropped and the rest stay packed at the front
+template <size_t cols, size_t rows, size_t rounds>
+class CbcJobLanes {
+    using Job = CbcJob<cols, rows, rounds>;
+
+    std::span<Job> jobs;
+    size_t nextJob = 0;
+
+    std::array<Job*, multiBufferLanes> laneJobs{};
+    std::array<size_t, multiBufferLanes> positions{};
+    size_t active = 0;
+
+    bool take(size_t lane) { // Next job with any blocks into lane, false when none are left
+        while (nextJob < jobs.size()) {
+            Job& job = jobs[nextJob++];
+
+            if (job.blocks.empty()) continue;
+
+            laneJobs[lane] = &job;
+            positions[lane] = 0;
+
+            return true;
+        }
+
+        return false;
+    }
+
+public:
+    explicit CbcJobLanes(std::span<Job> jobs) : jobs(jobs) {
+        while (active < multiBufferLanes && take(active)) active++;
+    }
+
+    size_t activeLanes() const {
+        return active;
+    }
+
+    Job& job(size_t lane) const {
+        return *laneJobs[lane];
+    }
+
+    Block<cols, rows>& block(size_t lane) const {
+        return laneJobs[lane]->blocks[positions[lane]];
+    }
+
+    void advance() { // Every active lane has encrypted its current block. Backwards, so a lane moved down from the end has already advanced
+        for (size_t lane = active; lane-- > 0;) {
+            if (++positions[lane] < laneJobs[lane]->blocks.size() || take(lane)) continue;
+
+            active--;
+            laneJobs[lane] = laneJobs[active];
+            positions[lane] = positions[active];
+        }
+    }
+};
+
+#if CPU_X86
+
+template <size_t rounds, size_t count = multiBufferLanes>
+CPU_TARGET("aes") void cbcEncryptStepAesNi(CbcJobLanes<4, 4, rounds>& lanes) { // One block of each active lane, with the lane count fixed at compile time so the states stay in registers
+    if constexpr (count > 1) {
+        if (lanes.activeLanes() < count) {
+            cbcEncryptStepAesNi<rounds, count - 1>(lanes);
+
+            return;
+        }
+    }
+
+    __m128i state[count];
+    const Block<4, 4>* keys[count]; // Round keys of each lane's schedule, stored one after another
+
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = &lanes.job(i).keySchedule->getRoundKey(0);
+
+        __m128i chain = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&lanes.job(i).chainBlock));
+        __m128i text = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&lanes.block(i)));
+
+        state[i] = _mm_xor_si128(_mm_xor_si128(text, chain), _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys[i])));
+    }
+
+    for (size_t n = 1; n < rounds; n++) {
+        for (size_t i = 0; i < count; i++) state[i] = _mm_aesenc_si128(state[i], _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys[i] + n)));
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        state[i] = _mm_aesenclast_si128(state[i], _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys[i] + rounds)));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&lanes.block(i)), state[i]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&lanes.job(i).chainBlock), state[i]);
+    }
+}
+
+#endif
+
+// Same ciphertext and final chain blocks as running BlockString::cbcEncryptBlocks on each job in turn. Only the hardware backend gains
+// from the interleave, the table engine walks the lanes one block at a time and bitsliced batches need all blocks under one key, so it uses the tables
+template <size_t cols, size_t rows, size_t rounds>
+void cbcEncryptJobs(std::span<CbcJob<cols, rows, rounds>> jobs, const RoundEngine<rows>& engine, EngineBackend backend = EngineBackend::Auto) {
+    CbcJobLanes<cols, rows, rounds> lanes(jobs);
+
+#if CPU_X86
+    if constexpr (cols == 4 && rows == 4) {
+        EngineBackend resolved = engine.template resolve<cols>(backend);
+
+        if (resolved == EngineBackend::AesNi || resolved == EngineBackend::Vaes) { // Lanes carry different keys, which one register of broadcast round keys can't serve, so VAES CPUs use the 128-bit kernel too
+            while (lanes.activeLanes() > 0) {
+                cbcEncryptStepAesNi<rounds>(lanes);
+                lanes.advance();
+            }
+
+            return;
+        }
+    }
+#endif
+
+    while (lanes.activeLanes() > 0) {
+        for (size_t i = 0; i < lanes.activeLanes(); i++) {
+            Block<cols, rows>& block = lanes.block(i);
+
+            block.addKey(lanes.job(i).chainBlock);
+            block.encrypt(*lanes.job(i).keySchedule, engine);
+            lanes.job(i).chainBlock = block;
+        }
+
+        lanes.advance();
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "kdf.hpp"
+#include "lru_cache.hpp"
+#include "block.hpp"
+#include "key_schedule.hpp"
+#include "cipher_parameters.hpp"
+#include "cipher_variant.hpp"
+
+// Key schedules derived from one password, cached by key ID (KDF settings and salt) and cipher variant. A batch run encrypts every file
+// under one salt (each file still gets its own IV), so the deliberately slow derivation runs once per run rather than once per file,
+// and decrypting those files again hits the cache the same way.
+class PasswordKeys {
+public:
+    using Schedule = DefaultCipherShape::Schedule;
+
+private:
+    static constexpr size_t cacheCapacity = 16; // Distinct salts seen in one run, usually one per batch that encrypted the files
+
+    std::string password;
+    KdfParameters encryptionKdf;
+
+    LruCache<std::string, std::shared_future<std::shared_ptr<const void>>> cache{cacheCapacity}; // Futures, so threads asking for a key being derived wait instead of deriving it again. Schedules of every variant share it, the key tells them apart
+
+    template <typename Shape>
+    std::shared_ptr<const typename Shape::Schedule> derive(const KdfParameters& kdf) const {
+        std::string keyBytes;
+
+        if (kdf.algorithm == KdfAlgorithm::None) {
+            if (password.length() != Shape::keySize) {
+                throw std::invalid_argument("Key does not match required length of " + std::to_string(Shape::keySize));
+            }
+
+            keyBytes = password;
+        } else {
+            std::vector<uint8_t> derived = Kdf::derive(password, kdf, Shape::keySize);
+            keyBytes.assign(derived.begin(), derived.end());
+        }
+
+        return std::make_shared<const typename Shape::Schedule>(Block<Shape::keyWordCount, rows>::fromString(keyBytes), subBox, Shape::roundConstants, mixColMatrixInv); // Expanded for both directions once
+    }
+
+public:
+    PasswordKeys(std::string password, const KdfParameters& encryptionKdf) : password(std::move(password)), encryptionKdf(encryptionKdf) {}
+
+    const KdfParameters& getEncryptionKdf() const { // Settings and salt written into the header of every file this run encrypts
+        return encryptionKdf;
+    }
+
+    template <typename Shape = DefaultCipherShape>
+    std::shared_ptr<const typename Shape::Schedule> get(const KdfParameters& kdf) {
+        std::promise<std::shared_ptr<const void>> promise;
+        bool deriving = false;
+
+        std::shared_future<std::shared_ptr<const void>> future = cache.getOrInsert(kdf.keyId() + static_cast<char>(Shape::keyWordCount), [&]() {
+            deriving = true;
+
+            return promise.get_future().share();
+        });
+
+        if (deriving) { // Derived outside the cache lock, other keys can be looked up meanwhile
+            try {
+                promise.set_value(derive<Shape>(kdf));
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        }
+
+        return std::static_pointer_cast<const typename Shape::Schedule>(future.get());
+    }
+};
@@ -0,0 +1,414 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+
+#include "gf256.hpp"
+#include "vector.hpp"
+#include "matrix.hpp"
+#include "substitution_box.hpp"
+#include "aes_ni.hpp"
+#include "bitsliced.hpp"
+#include "cpu_features.hpp"
+#include "util.hpp"
+
+template <size_t cols, size_t rows>
+class Block;
+
+template <size_t cols, size_t rows, size_t rounds>
+class KeySchedule;
+
+enum class EngineBackend {
+    Auto, // Fastest backend available for the parameters and CPU
+    Table, // T-tables for 4 row blocks, the plain Block steps otherwise
+    Bitsliced, // Constant time, 8 or 16 blocks at once in SSSE3/AVX2 registers, batches only
+    AesNi,
+    Vaes // AES-NI rounds on four blocks per instruction, batches only, single blocks still go through AesNi
+};
+
+// Holds the cipher parameters and, for 4 row blocks, the T-tables which fuse SubBytes, ShiftRows and MixColumns into 4 lookups per column
+template <size_t rows>
+class RoundEngine {
+    static constexpr bool tableEngine = rows == 4;
+    static constexpr size_t tableCount = tableEngine ? 4 : 0;
+
+    using Table = std::array<uint32_t, 256>;
+
+    SubstitutionBox subBox;
+    Matrix<rows> mixColMatrix;
+    Matrix<rows> mixColMatrixInv;
+
+    std::array<Table, tableCount> encTables; // encTables[r][x] = column r of mixColMatrix multiplied by sub(x)
+    std::array<Table, tableCount> decTables; // decTables[r][x] = column r of mixColMatrixInv multiplied by subInv(x)
+    std::array<uint8_t, 256> subTable;
+    std::array<uint8_t, 256> subInvTable;
+
+    bool aesParameters; // Whether the hardware AES rounds compute exactly what the tables above would
+    BitslicedParameters bitslicedParameters;
+
+    static constexpr int byteShift(int row) { // Bit offset of a row's byte once a column is packed into a word
+        return std::endian::native == std::endian::little ? row * 8 : (3 - row) * 8;
+    }
+
+    static constexpr uint8_t getByte(uint32_t word, int row) {
+        return static_cast<uint8_t>(word >> byteShift(row));
+    }
+
+    static constexpr uint32_t packColumn(const Vector<rows>& column) {
+        return std::bit_cast<uint32_t>(column);
+    }
+
+    static constexpr Vector<rows> unpackColumn(uint32_t word) {
+        return std::bit_cast<Vector<rows>>(word);
+    }
+
+    static constexpr Table generateTable(const Matrix<rows>& mat, const std::array<uint8_t, 256>& byteMap, int col) {
+        Table table{};
+
+        for (size_t x = 0; x < 256; x++) {
+            Vector<rows> column;
+
+            for (size_t r = 0; r < rows; r++) {
+                column[r] = mat[r][col] * GF256(byteMap[x]);
+            }
+
+            table[x] = packColumn(column);
+        }
+
+        return table;
+    }
+
+    static constexpr bool matchesAES(const std::array<uint8_t, 256>& subTable, const Matrix<rows>& mixColMatrix) {
+        if constexpr (!tableEngine) {
+            return false;
+        } else {
+            for (size_t x = 0; x < 256; x++) {
+                if (subTable[x] != aesSubBox[x]) return false;
+            }
+
+            for (size_t r = 0; r < rows; r++) {
+                for (size_t c = 0; c < rows; c++) {
+                    if (mixColMatrix[r][c].get() != aesMixColumnRow[mod(c + rows - r, rows)]) return false;
+                }
+            }
+
+            return true;
+        }
+    }
+
+    constexpr uint32_t invMixWord(uint32_t word) const { // Cancels the inverse substitution baked into decTables, leaving only mixColMatrixInv applied to the word
+        return decTables[0][subTable[getByte(word, 0)]]
+             ^ decTables[1][subTable[getByte(word, 1)]]
+             ^ decTables[2][subTable[getByte(word, 2)]]
+             ^ decTables[3][subTable[getByte(word, 3)]];
+    }
+
+    template <size_t cols, size_t rounds>
+    void encryptTable(Block<cols, rows>& block, const KeySchedule<cols, rows, rounds>& keySchedule) const {
+        if constexpr (!tableEngine) {
+            block.encrypt(keySchedule, subBox, mixColMatrix);
+        } else {
+            std::array<uint32_t, cols> state;
+            std::array<uint32_t, cols> next;
+
+            const Block<cols, rows>& firstKey = keySchedule.getRoundKey(0);
+
+            for (size_t c = 0; c < cols; c++) {
+                state[c] = packColumn(block[c]) ^ packColumn(firstKey[c]);
+            }
+
+            for (size_t n = 1; n < rounds; n++) {
+                const Block<cols, rows>& roundKey = keySchedule.getRoundKey(n);
+
+                for (size_t c = 0; c < cols; c++) { // Row r of column c comes from column c + rowShift(r) after ShiftRows
+                    next[c] = encTables[0][getByte(state[c], 0)]
+                            ^ encTables[1][getByte(state[mod(c + rowShift(cols, 1), cols)], 1)]
+                            ^ encTables[2][getByte(state[mod(c + rowShift(cols, 2), cols)], 2)]
+                            ^ encTables[3][getByte(state[mod(c + rowShift(cols, 3), cols)], 3)]
+                            ^ packColumn(roundKey[c]);
+                }
+
+                state = next;
+            }
+
+            const Block<cols, rows>& lastKey = keySchedule.getRoundKey(rounds);
+
+            for (size_t c = 0; c < cols; c++) { // Final round has no MixColumns
+                uint32_t word = 0;
+
+                for (size_t r = 0; r < 4; r++) {
+                    word |= static_cast<uint32_t>(subTable[getByte(state[mod(c + rowShift(cols, r), cols)], r)]) << byteShift(r);
+                }
+
+                block[c] = unpackColumn(word ^ packColumn(lastKey[c]));
+            }
+        }
+    }
+
+    template <size_t cols, size_t rounds>
+    void decryptTable(Block<cols, rows>& block, const KeySchedule<cols, rows, rounds>& keySchedule) const {
+        if constexpr (!tableEngine) {
+            block.decrypt(keySchedule, subBox, mixColMatrixInv);
+        } else { // Equivalent inverse cipher, round keys are passed through mixColMatrixInv so MixColumns can be fused into the lookups
+            std::array<uint32_t, cols> state;
+            std::array<uint32_t, cols> next;
+
+            const Block<cols, rows>& firstKey = keySchedule.getRoundKey(rounds);
+
+            for (size_t c = 0; c < cols; c++) {
+                state[c] = packColumn(block[c]) ^ packColumn(firstKey[c]);
+            }
+
+            for (size_t n = rounds - 1; n >= 1; n--) {
+                std::array<uint32_t, cols> roundKey;
+
+                if (keySchedule.hasInverseKeys()) { // Already transformed when the schedule was built
+                    const Block<cols, rows>& inverseKey = keySchedule.getInverseRoundKey(rounds - n);
+
+                    for (size_t c = 0; c < cols; c++) roundKey[c] = packColumn(inverseKey[c]);
+                } else {
+                    const Block<cols, rows>& forwardKey = keySchedule.getRoundKey(n);
+
+                    for (size_t c = 0; c < cols; c++) roundKey[c] = invMixWord(packColumn(forwardKey[c]));
+                }
+
+                for (size_t c = 0; c < cols; c++) { // Row r of column c comes from column c - rowShift(r) after the inverse ShiftRows, cols is added first to stay unsigned
+                    next[c] = decTables[0][getByte(state[c], 0)]
+                            ^ decTables[1][getByte(state[mod(c + cols - rowShift(cols, 1), cols)], 1)]
+                            ^ decTables[2][getByte(state[mod(c + cols - rowShift(cols, 2), cols)], 2)]
+                            ^ decTables[3][getByte(state[mod(c + cols - rowShift(cols, 3), cols)], 3)]
+                            ^ roundKey[c];
+                }
+
+                state = next;
+            }
+
+            const Block<cols, rows>& lastKey = keySchedule.getRoundKey(0);
+
+            for (size_t c = 0; c < cols; c++) {
+                uint32_t word = 0;
+
+                for (size_t r = 0; r < 4; r++) {
+                    word |= static_cast<uint32_t>(subInvTable[getByte(state[mod(c + cols - rowShift(cols, r), cols)], r)]) << byteShift(r);
+                }
+
+                block[c] = unpackColumn(word ^ packColumn(lastKey[c]));
+            }
+        }
+    }
+
+public:
+    constexpr RoundEngine(const SubstitutionBox& subBox, const Matrix<rows>& mixColMatrix, const Matrix<rows>& mixColMatrixInv)
+        : subBox(subBox), mixColMatrix(mixColMatrix), mixColMatrixInv(mixColMatrixInv), encTables{}, decTables{}, subTable{}, subInvTable{}, aesParameters(false), bitslicedParameters{} {
+        for (size_t x = 0; x < 256; x++) {
+            subTable[x] = subBox.sub(x).get();
+            subInvTable[x] = subBox.subInv(x).get();
+        }
+
+        if constexpr (tableEngine) {
+            for (size_t r = 0; r < tableCount; r++) {
+                encTables[r] = generateTable(mixColMatrix, subTable, r);
+                decTables[r] = generateTable(mixColMatrixInv, subInvTable, r);
+            }
+        }
+
+        aesParameters = matchesAES(subTable, mixColMatrix);
+
+        if constexpr (tableEngine) {
+            bitslicedParameters = BitslicedParameters::derive(subTable, subInvTable, mixColMatrix, mixColMatrixInv);
+        }
+    }
+
+    constexpr const SubstitutionBox& getSubBox() const {
+        return subBox;
+    }
+
+    constexpr const Matrix<rows>& getMixColMatrix() const {
+        return mixColMatrix;
+    }
+
+    constexpr const Matrix<rows>& getMixColMatrixInv() const {
+        return mixColMatrixInv;
+    }
+
+    constexpr bool hasAESParameters() const {
+        return aesParameters;
+    }
+
+    template <size_t cols>
+    bool supports(EngineBackend backend) const {
+        switch (backend) {
+            case EngineBackend::Auto:
+            case EngineBackend::Table:
+                return true;
+            case EngineBackend::Bitsliced: // Needs 16 byte blocks and a circuit form of the parameters
+#ifdef BITSLICED_ENGINE
+                if constexpr (cols == 4 && rows == 4) {
+                    return bitslicedParameters.valid && CpuFeatures::get().hasSSSE3();
+                }
+#endif
+
+                return false;
+            case EngineBackend::AesNi: // Standard AES parameters on a CPU with AES-NI, anything else stays in software
+#if CPU_X86
+                if constexpr (cols == 4 && rows == 4) {
+                    return aesParameters && CpuFeatures::get().hasAES();
+                }
+#endif
+
+                return false;
+            case EngineBackend::Vaes:
+#if CPU_X86
+                if constexpr (cols == 4 && rows == 4) {
+                    return aesParameters && CpuFeatures::get().hasAES() && CpuFeatures::get().hasVAES() && CpuFeatures::get().hasAVX512();
+                }
+#endif
+
+                return false;
+            default:
+                throw std::invalid_argument("Unknown engine backend enum value");
+        }
+    }
+
+    template <size_t cols>
+    EngineBackend resolve(EngineBackend backend) const { // Picks the concrete backend batches will use
+        if (backend == EngineBackend::Auto) {
+            if (supports<cols>(EngineBackend::Vaes)) return EngineBackend::Vaes;
+            if (supports<cols>(EngineBackend::AesNi)) return EngineBackend::AesNi;
+            if (supports<cols>(EngineBackend::Bitsliced)) return EngineBackend::Bitsliced;
+
+            return EngineBackend::Table;
+        }
+
+        if (!supports<cols>(backend)) {
+            throw std::invalid_argument("Engine backend is not available for these parameters on this CPU");
+        }
+
+        return backend;
+    }
+
+    template <size_t cols, size_t rounds>
+    void encrypt(Block<cols, rows>& block, const KeySchedule<cols, rows, rounds>& keySchedule) const { // Single blocks only choose between the hardware and the tables, a bitsliced pass would waste all but one lane
+#if CPU_X86
+        if constexpr (cols == 4 && rows == 4) {
+            if (supports<cols>(EngineBackend::AesNi)) {
+                AesNiKeys<rounds>::encryptBlock(block, keySchedule);
+
+                return;
+            }
+        }
+#endif
+
+        encryptTable(block, keySchedule);
+    }
+
+    template <size_t cols, size_t rounds>
+    void decrypt(Block<cols, rows>& block, const KeySchedule<cols, rows, rounds>& keySchedule) const {
+#if CPU_X86
+        if constexpr (cols == 4 && rows == 4) {
+            if (supports<cols>(EngineBackend::AesNi)) {
+                AesNiKeys<rounds>::decryptBlock(block, keySchedule);
+
+                return;
+            }
+        }
+#endif
+
+        decryptTable(block, keySchedule);
+    }
+
+    template <size_t cols, size_t rounds>
+    void encryptBlocks(Block<cols, rows>* blocks, size_t count, const KeySchedule<cols, rows, rounds>& keySchedule, EngineBackend backend = EngineBackend::Auto) const { // Independent blocks, lets the backend convert the schedule once and overlap blocks
+        switch (resolve<cols>(backend)) {
+#if CPU_X86
+            case EngineBackend::AesNi:
+                if constexpr (cols == 4 && rows == 4) AesNiKeys<rounds>(keySchedule).encryptBlocks(blocks, count);
+
+                return;
+            case EngineBackend::Vaes:
+                if constexpr (cols == 4 && rows == 4) VaesKeys<rounds>(keySchedule).encryptBlocks(blocks, count);
+
+                return;
+#endif
+#ifdef BITSLICED_ENGINE
+            case EngineBackend::Bitsliced:
+                if constexpr (cols == 4 && rows == 4) {
+                    if (CpuFeatures::get().hasAVX2()) bitslicedEncryptAVX2(blocks, count, keySchedule, bitslicedParameters);
+                    else bitslicedEncryptSSSE3(blocks, count, keySchedule, bitslicedParameters);
+                }
+
+                return;
+#endif
+            default:
+                for (size_t i = 0; i < count; i++) {
+                    encryptTable(blocks[i], keySchedule);
+                }
+        }
+    }
+
+    template <size_t cols, size_t rounds>
+    void encryptCounters(Block<cols, rows>* blocks, size_t count, const Block<cols, rows>& first, const KeySchedule<cols, rows, rounds>& keySchedule, EngineBackend backend = EngineBackend::Auto) const { // Counter mode keystream, blocks[i] = E(first + i) reading first as one big endian number
+        if (count == 0) return;
+
+        EngineBackend resolved = resolve<cols>(backend);
+
+#if CPU_X86
+        if constexpr (cols == 4 && rows == 4) {
+            uint64_t low = 0; // Last 8 bytes of the counter, the VAES kernel only adds within them
+
+            for (size_t i = 8; i < 16; i++) low = low << 8 | first[i / rows][i % rows].get();
+
+            if (resolved == EngineBackend::Vaes && low <= UINT64_MAX - (count - 1)) {
+                VaesKeys<rounds>(keySchedule).encryptCounters(blocks, count, first);
+
+                return;
+            }
+        }
+#endif
+
+        blocks[0] = first;
+
+        for (size_t i = 1; i < count; i++) {
+            blocks[i] = blocks[i - 1];
+
+            for (size_t byte = cols * rows; byte-- > 0;) { // Big endian increment, the carry rarely passes the last byte
+                GF256& value = blocks[i][byte / rows][byte % rows];
+                value = static_cast<uint8_t>(value.get() + 1);
+
+                if (value.get() != 0) break;
+            }
+        }
+
+        encryptBlocks(blocks, count, keySchedule, resolved);
+    }
+
+    template <size_t cols, size_t rounds>
+    void decryptBlocks(Block<cols, rows>* blocks, size_t count, const KeySchedule<cols, rows, rounds>& keySchedule, EngineBackend backend = EngineBackend::Auto) const {
+        switch (resolve<cols>(backend)) {
+#if CPU_X86
+            case EngineBackend::AesNi:
+                if constexpr (cols == 4 && rows == 4) AesNiKeys<rounds>(keySchedule).decryptBlocks(blocks, count);
+
+                return;
+            case EngineBackend::Vaes:
+                if constexpr (cols == 4 && rows == 4) VaesKeys<rounds, true>(keySchedule).decryptBlocks(blocks, count);
+
+                return;
+#endif
+#ifdef BITSLICED_ENGINE
+            case EngineBackend::Bitsliced:
+                if constexpr (cols == 4 && rows == 4) {
+                    if (CpuFeatures::get().hasAVX2()) bitslicedDecryptAVX2(blocks, count, keySchedule, bitslicedParameters);
+                    else bitslicedDecryptSSSE3(blocks, count, keySchedule, bitslicedParameters);
+                }
+
+                return;
+#endif
+            default:
+                for (size_t i = 0; i < count; i++) {
+                    decryptTable(blocks[i], keySchedule);
+                }
+        }
+    }
+};
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#if defined(__linux__)
+#define SYSTEM_GETRANDOM 1
+#include <sys/random.h>
+#else
+#define SYSTEM_GETRANDOM 0
+#include <random>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FORK_HANDLERS 1
+#include <pthread.h>
+#else
+#define FORK_HANDLERS 0
+#endif
+
+#include "block.hpp"
+#include "key_schedule.hpp"
+#include "cipher_parameters.hpp"
+#include "cipher_variant.hpp"
+
+// Random bytes for IVs and salts. Each thread runs its own AES-256 counter mode generator seeded from the kernel, so a draw is a copy out
+// of a buffer and never takes a lock or a system call. Every refill encrypts a whole buffer of counters on the engine's fastest backend
+// and keeps its first two blocks as the next key, so state captured later can't reproduce bytes already handed out (fast key erasure).
+// Kernel entropy is mixed into the key again every reseedInterval refills, and straight away in a child after fork, which would
+// otherwise repeat the parent's stream.
+class SecureRandom {
+public:
+    using Shape = CipherShape<8>;
+    using Schedule = Shape::Schedule;
+    using Key = std::array<char, Shape::keySize>;
+
+    static constexpr size_t bufferBlocks = 256; // 4 KiB per refill, so the key expansion after each one costs little per byte
+
+private:
+    static constexpr size_t reseedInterval = 1 << 14; // Refills, about 64 MiB of output
+
+    static inline std::atomic<uint64_t> forkGeneration = 0; // Bumped in the child of every fork
+
+    std::array<Block<cols, rows>, bufferBlocks> buffer;
+    Key key;
+    Schedule keySchedule;
+    size_t position = sizeof(buffer); // Next unserved byte of buffer, the bytes before it are already wiped
+    size_t refills = 0;
+    uint64_t generation = forkGeneration.load(std::memory_order_relaxed);
+
+    static Schedule expand(const Key& key) {
+        Block<Shape::keyWordCount, rows> keyBlock;
+        std::memcpy(&keyBlock, key.data(), key.size());
+
+        return Schedule(keyBlock, subBox, Shape::roundConstants);
+    }
+
+    static void registerForkHandler() {
+#if FORK_HANDLERS
+        static const bool registered = pthread_atfork(nullptr, nullptr, []() { forkGeneration.fetch_add(1, std::memory_order_relaxed); }) == 0;
+
+        if (!registered) {
+            throw std::runtime_error("Failed to register the random generator's fork handler");
+        }
+#endif
+    }
+
+    char* bufferBytes() {
+        return reinterpret_cast<char*>(buffer.data());
+    }
+
+    void refill() {
+        if (++refills >= reseedInterval) reseed();
+
+        roundEngine.encryptCounters(buffer.data(), bufferBlocks, Block<cols, rows>(), keySchedule); // The key never repeats, so every refill can count from zero
+
+        std::memcpy(key.data(), bufferBytes(), key.size());
+        std::memset(bufferBytes(), 0, key.size());
+        keySchedule = expand(key);
+        position = key.size();
+    }
+
+    void reseed() { // The kernel's bytes are added to the current key rather than replacing it, so a weak kernel source never makes things worse
+        Key entropy;
+        systemRandom(entropy.data(), entropy.size());
+
+        for (size_t i = 0; i < key.size(); i++) key[i] ^= entropy[i];
+
+        std::memset(entropy.data(), 0, entropy.size());
+        keySchedule = expand(key);
+
+        refills = 0;
+        generation = forkGeneration.load(std::memory_order_relaxed);
+        position = sizeof(buffer); // Bytes left from before a fork are the parent's, they are never served
+    }
+
+public:
+    explicit SecureRandom(const Key& seed) : key(seed), keySchedule(expand(seed)) { // Deterministic until the first reseed, for tests
+        registerForkHandler();
+    }
+
+    SecureRandom() : SecureRandom(systemSeed()) {}
+
+    SecureRandom(const SecureRandom&) = delete;
+    SecureRandom& operator=(const SecureRandom&) = delete;
+
+    ~SecureRandom() {
+        std::memset(bufferBytes(), 0, sizeof(buffer));
+        std::memset(key.data(), 0, key.size());
+    }
+
+    static SecureRandom& local() { // The calling thread's generator, seeded on first use
+        thread_local SecureRandom generator;
+
+        return generator;
+    }
+
+    static void systemRandom(char* output, size_t length) { // Straight from the kernel, a system call per request
+#if SYSTEM_GETRANDOM
+        while (length > 0) {
+            ssize_t count = getrandom(output, length, 0);
+
+            if (count < 0) {
+                if (errno == EINTR) continue;
+
+                throw std::system_error(errno, std::generic_category(), "getrandom failed");
+            }
+
+            output += count;
+            length -= count;
+        }
+#else
+        std::random_device device;
+
+        for (size_t i = 0; i < length; i++) output[i] = static_cast<char>(device());
+#endif
+    }
+
+    static Key systemSeed() {
+        Key seed;
+        systemRandom(seed.data(), seed.size());
+
+        return seed;
+    }
+
+    void fill(char* output, size_t length) {
+        if (generation != forkGeneration.load(std::memory_order_relaxed)) reseed(); // Also covers a fork while bytes were still buffered
+
+        while (length > 0) {
+            if (position == sizeof(buffer)) refill();
+
+            size_t count = std::min(length, sizeof(buffer) - position);
+
+            std::memcpy(output, bufferBytes() + position, count);
+            std::memset(bufferBytes() + position, 0, count); // Served bytes don't stay in memory
+
+            output += count;
+            length -= count;
+            position += count;
+        }
+    }
+
+    std::string bytes(size_t length) {
+        std::string output(length, '\0');
+        fill(output.data(), length);
+
+        return output;
+    }
+};
@@ -0,0 +1,534 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstring>
+
+#include "block.hpp"
+#include "key_schedule.hpp"
+#include "round_engine.hpp"
+#include "substitution_box.hpp"
+#include "cipher_parameters.hpp"
+#include "sha256.hpp"
+#include "kdf.hpp"
+#include "block_string.hpp"
+#include "multi_buffer.hpp"
+#include "secure_random.hpp"
+#include "ghash.hpp"
+#include "gcm_stream.hpp"
+
+#if FORK_HANDLERS
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+// Known answer tests from FIPS-197, the GCM specification, FIPS 180-4 and the PBKDF2 and scrypt RFCs, plus consistency checks between the reference path, the engine backends and the S-box kernels,
+// and the FIPS 140-2 statistical tests on the random generator.
+// The FIPS vectors only apply when the configured parameters are the AES ones, otherwise only the consistency checks run.
+class SelfTest {
+    std::ostream& stream;
+    size_t failures = 0;
+
+    static std::string fromHex(const std::string& hex) {
+        std::string bytes;
+
+        for (size_t i = 0; i + 1 < hex.length(); i += 2) {
+            bytes += static_cast<char>(std::stoi(hex.substr(i, 2), nullptr, 16));
+        }
+
+        return bytes;
+    }
+
+    template <size_t blockCols>
+    static std::string toHex(const Block<blockCols, rows>& block) {
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string hex;
+
+        for (size_t c = 0; c < blockCols; c++) {
+            for (size_t r = 0; r < rows; r++) {
+                hex += digits[block[c][r].get() >> 4];
+                hex += digits[block[c][r].get() & 0xF];
+            }
+        }
+
+        return hex;
+    }
+
+    static std::string toHex(const uint8_t* bytes, size_t length) {
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string hex;
+
+        for (size_t i = 0; i < length; i++) {
+            hex += digits[bytes[i] >> 4];
+            hex += digits[bytes[i] & 0xF];
+        }
+
+        return hex;
+    }
+
+    void check(const std::string& name, bool passed) {
+        stream << (passed ? "ok      " : "FAILED  ") << name << '\n';
+
+        if (!passed) failures++;
+    }
+
+    void checkSubstitution() {
+        if (roundEngine.hasAESParameters()) {
+            check("S-box FIPS-197 values", subBox.sub(0x00).get() == 0x63 && subBox.sub(0x53).get() == 0xED && subBox.subInv(0xED).get() == 0x53);
+        }
+
+        for (size_t length : {1, 16, 23, 32, 64, 71}) { // Covers the AVX2, SSSE3 and padded tail paths
+            std::vector<GF256> forward(length), inverse(length);
+            bool matches = true;
+
+            for (int start = 0; start < 256; start += 7) {
+                for (size_t i = 0; i < length; i++) {
+                    forward[i] = static_cast<uint8_t>(start + i * 13);
+                    inverse[i] = forward[i];
+                }
+
+                subBox.substitute<false>(forward.data(), length);
+                subBox.substitute<true>(inverse.data(), length);
+
+                for (size_t i = 0; i < length; i++) {
+                    GF256 value = static_cast<uint8_t>(start + i * 13);
+
+                    matches &= forward[i].get() == subBox.sub(value).get() && inverse[i].get() == subBox.subInv(value).get();
+                }
+            }
+
+            check("S-box kernel matches lookup, " + std::to_string(length) + " bytes", matches);
+        }
+    }
+
+    template <size_t keyCols, size_t keyRounds>
+    void checkCipher(const std::string& name, const std::string& keyHex, const std::string& plainHex, const std::string& cipherHex) {
+        Block<keyCols, rows> key = Block<keyCols, rows>::fromString(fromHex(keyHex));
+        KeySchedule<cols, rows, keyRounds> keySchedule(key, subBox, makeRoundConstants<roundConstantCount(cols, keyCols, keyRounds)>());
+
+        Block<cols, rows> plain = Block<cols, rows>::fromString(fromHex(plainHex));
+        Block<cols, rows> reference = plain;
+
+        reference.encrypt(keySchedule, subBox, mixColMatrix);
+        if (roundEngine.hasAESParameters()) check(name + " reference encrypt", toHex(reference) == cipherHex);
+
+        reference.decrypt(keySchedule, subBox, mixColMatrixInv);
+        check(name + " reference round trip", toHex(reference) == plainHex);
+
+        Block<cols, rows> expected = plain;
+        expected.encrypt(keySchedule, subBox, mixColMatrix);
+
+        Block<cols, rows> single = plain;
+        roundEngine.encrypt(single, keySchedule);
+        check(name + " engine encrypt", toHex(single) == toHex(expected));
+
+        roundEngine.decrypt(single, keySchedule);
+        check(name + " engine decrypt", toHex(single) == plainHex);
+
+        for (EngineBackend backend : {EngineBackend::Table, EngineBackend::Bitsliced, EngineBackend::AesNi, EngineBackend::Vaes}) {
+            if (!roundEngine.supports<cols>(backend)) continue;
+
+            std::vector<Block<cols, rows>> blocks(37, plain); // Odd count so every backend also runs its partial batch
+            bool encrypted = true;
+            bool decrypted = true;
+
+            roundEngine.encryptBlocks(blocks.data(), blocks.size(), keySchedule, backend);
+            for (const Block<cols, rows>& block : blocks) encrypted &= toHex(block) == toHex(expected);
+
+            roundEngine.decryptBlocks(blocks.data(), blocks.size(), keySchedule, backend);
+            for (const Block<cols, rows>& block : blocks) decrypted &= toHex(block) == plainHex;
+
+            check(name + " " + backendName(backend) + " batch", encrypted && decrypted);
+
+            std::vector<Block<cols, rows>> keystream(37);
+            Block<cols, rows> counter = plain; // Ends in 0xff, so the first increment already carries
+            bool counted = true;
+
+            roundEngine.encryptCounters(keystream.data(), keystream.size(), counter, keySchedule, backend);
+
+            for (const Block<cols, rows>& block : keystream) {
+                Block<cols, rows> counterBlock = counter;
+                counterBlock.encrypt(keySchedule, subBox, mixColMatrix);
+                counted &= toHex(block) == toHex(counterBlock);
+
+                for (size_t i = cols * rows; i-- > 0;) { // Big endian increment
+                    GF256& byte = counter[i / rows][i % rows];
+                    byte = static_cast<uint8_t>(byte.get() + 1);
+
+                    if (byte.get() != 0) break;
+                }
+            }
+
+            check(name + " " + backendName(backend) + " counter keystream", counted);
+        }
+
+        checkInverseKeys<keyCols, keyRounds>(name, key, expected, plainHex);
+        checkMultiBuffer<keyCols, keyRounds>(name, key);
+    }
+
+    template <size_t keyCols, size_t keyRounds>
+    void checkMultiBuffer(const std::string& name, const Block<keyCols, rows>& key) { // Interleaved CBC jobs of mixed lengths and keys against one chain at a time
+        Block<keyCols, rows> otherKey = key;
+        otherKey[0][0] = otherKey[0][0] + GF256(1);
+
+        std::array<KeySchedule<cols, rows, keyRounds>, 2> keySchedules = {
+            KeySchedule<cols, rows, keyRounds>(key, subBox, makeRoundConstants<keyRounds>()),
+            KeySchedule<cols, rows, keyRounds>(otherKey, subBox, makeRoundConstants<keyRounds>())
+        };
+
+        std::vector<std::vector<Block<cols, rows>>> messages;
+
+        for (size_t m = 0; m < 21; m++) { // More jobs than lanes, some empty, so lanes are refilled and dropped
+            std::string text;
+
+            for (size_t i = 0; i < (m * 7) % 23 * cols * rows; i++) text += static_cast<char>(m * 31 + i);
+
+            std::vector<Block<cols, rows>> blocks;
+            for (size_t i = 0; i < text.size(); i += cols * rows) blocks.push_back(Block<cols, rows>::fromString(text.substr(i, cols * rows)));
+
+            messages.push_back(blocks);
+        }
+
+        for (EngineBackend backend : {EngineBackend::Table, EngineBackend::AesNi}) {
+            if (!roundEngine.supports<cols>(backend)) continue;
+
+            std::vector<std::vector<Block<cols, rows>>> interleaved = messages;
+            std::vector<CbcJob<cols, rows, keyRounds>> jobs;
+            bool matches = true;
+
+            for (size_t m = 0; m < messages.size(); m++) {
+                jobs.push_back({&keySchedules[m % 2], Block<cols, rows>::fromString(std::string(1, static_cast<char>(m))), interleaved[m]});
+            }
+
+            cbcEncryptJobs(std::span(jobs), roundEngine, backend);
+
+            for (size_t m = 0; m < messages.size(); m++) {
+                std::vector<Block<cols, rows>> serial = messages[m];
+                Block<cols, rows> chainBlock = Block<cols, rows>::fromString(std::string(1, static_cast<char>(m)));
+
+                BlockString<cols, rows>::cbcEncryptBlocks(serial.data(), serial.size(), keySchedules[m % 2], roundEngine, chainBlock);
+
+                matches &= toHex(chainBlock) == toHex(jobs[m].chainBlock);
+
+                for (size_t i = 0; i < serial.size(); i++) matches &= toHex(serial[i]) == toHex(interleaved[m][i]);
+            }
+
+            check(name + " " + backendName(backend) + " multi-buffer CBC", matches);
+        }
+    }
+
+    template <size_t keyCols, size_t keyRounds>
+    void checkInverseKeys(const std::string& name, const Block<keyCols, rows>& key, const Block<cols, rows>& cipherBlock, const std::string& plainHex) { // Schedules carrying equivalent inverse keys, and their serialized form
+        KeySchedule<cols, rows, keyRounds> built(key, subBox, makeRoundConstants<keyRounds>(), mixColMatrixInv);
+        KeySchedule<cols, rows, keyRounds> loaded = KeySchedule<cols, rows, keyRounds>::deserialize(built.serialize());
+
+        check(name + " schedule serialization round trip", loaded.hasInverseKeys() && loaded.serialize() == built.serialize());
+
+        Block<cols, rows> single = cipherBlock;
+        roundEngine.decrypt(single, loaded);
+        bool decrypted = toHex(single) == plainHex;
+
+        for (EngineBackend backend : {EngineBackend::Table, EngineBackend::Bitsliced, EngineBackend::AesNi, EngineBackend::Vaes}) {
+            if (!roundEngine.supports<cols>(backend)) continue;
+
+            std::vector<Block<cols, rows>> blocks(37, cipherBlock);
+            roundEngine.decryptBlocks(blocks.data(), blocks.size(), loaded, backend);
+
+            for (const Block<cols, rows>& block : blocks) decrypted &= toHex(block) == plainHex;
+        }
+
+        check(name + " equivalent inverse keys decrypt", decrypted);
+    }
+
+    void checkKeyExpansion() { // FIPS-197 appendices A.1 and A.3, the last round keys of the 128 and 256-bit examples
+        Block<4, rows> key = Block<4, rows>::fromString(fromHex("2b7e151628aed2a6abf7158809cf4f3c"));
+        KeySchedule<4, rows, 10> keySchedule(key, subBox, makeRoundConstants<10>());
+
+        check("AES-128 key expansion", toHex(keySchedule.getRoundKey(10)) == "d014f9a8c9ee2589e13f0cc8b6630ca6");
+
+        Block<8, rows> longKey = Block<8, rows>::fromString(fromHex("603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4"));
+        KeySchedule<4, rows, 14> longKeySchedule(longKey, subBox, makeRoundConstants<roundConstantCount(4, 8, 14)>());
+
+        check("AES-256 key expansion", toHex(longKeySchedule.getRoundKey(14)) == "fe4890d1e6188d0b046df344706c631e");
+    }
+
+    template <size_t blockCols, size_t keyCols>
+    void checkWideBlock(const std::string& name) { // Rijndael blocks wider than AES, engine against the reference path, which share no ShiftRows code
+        constexpr size_t wideRounds = std::max(blockCols, keyCols) + 6;
+
+        std::string keyBytes, plainBytes;
+
+        for (size_t i = 0; i < keyCols * rows; i++) keyBytes += static_cast<char>(i * 17 + 3);
+        for (size_t i = 0; i < blockCols * rows; i++) plainBytes += static_cast<char>(i * 29 + 11);
+
+        KeySchedule<blockCols, rows, wideRounds> keySchedule(Block<keyCols, rows>::fromString(keyBytes), subBox, makeRoundConstants<roundConstantCount(blockCols, keyCols, wideRounds)>(), mixColMatrixInv);
+        Block<blockCols, rows> plain = Block<blockCols, rows>::fromString(plainBytes);
+
+        Block<blockCols, rows> reference = plain;
+        reference.encrypt(keySchedule, subBox, mixColMatrix);
+
+        Block<blockCols, rows> engine = plain;
+        roundEngine.encrypt(engine, keySchedule);
+        bool encrypted = toHex(engine) == toHex(reference) && toHex(engine) != toHex(plain);
+
+        roundEngine.decrypt(engine, keySchedule);
+        reference.decrypt(keySchedule, subBox, mixColMatrixInv);
+
+        check(name + " engine matches reference", encrypted && toHex(engine) == toHex(plain) && toHex(reference) == toHex(plain));
+    }
+
+    void checkGcm() { // Test cases 1 to 4 of the GCM specification, GHASH alone on both multiply paths, then the whole stream both ways
+        struct GcmCase {
+            std::string key;
+            std::string iv;
+            std::string plain;
+            std::string aad;
+            std::string cipher;
+            std::string hash; // GHASH of the AAD and ciphertext, before the tag mask
+            std::string tag;
+        };
+
+        const std::string longPlain = "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255";
+        const std::string longCipher = "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985";
+
+        const std::vector<GcmCase> cases = {
+            {"00000000000000000000000000000000", "000000000000000000000000", "", "", "",
+             "00000000000000000000000000000000", "58e2fccefa7e3061367f1d57a4e7455a"},
+            {"00000000000000000000000000000000", "000000000000000000000000", "00000000000000000000000000000000", "", "0388dace60b6a392f328c2b971b2fe78",
+             "f38cbb1ad69223dcc3457ae5b6b0f885", "ab6e47d42cec13bdf53a67b21257bddf"},
+            {"feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", longPlain, "", longCipher,
+             "7f1b32b81b820d02614f8895ac1d4eac", "4d5c2af327cd64a62cf35abd2ba6fab4"},
+            {"feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", longPlain.substr(0, 120), "feedfacedeadbeeffeedfacedeadbeefabaddad2", longCipher.substr(0, 120),
+             "698e57f70e6ecc7fd9463b7260a9ae5f", "5bc94fbc3221a5db94fae95ae7121a47"}
+        };
+
+        for (size_t n = 0; n < cases.size(); n++) {
+            const GcmCase& gcmCase = cases[n];
+            std::string name = "GCM test case " + std::to_string(n + 1);
+            std::string plain = fromHex(gcmCase.plain);
+            std::string aad = fromHex(gcmCase.aad);
+            std::string cipher = fromHex(gcmCase.cipher);
+
+            KeySchedule<4, rows, 10> keySchedule(Block<4, rows>::fromString(fromHex(gcmCase.key)), subBox, makeRoundConstants<10>());
+            Block<4, rows> hashKeyBlock;
+            GHash::Bytes hashKey;
+
+            roundEngine.encrypt(hashKeyBlock, keySchedule);
+            std::memcpy(hashKey.data(), &hashKeyBlock, hashKey.size());
+
+            for (bool clmul : {true, false}) {
+                GHash ghash(hashKey, clmul);
+
+                if (clmul && !ghash.usesClmul()) continue;
+
+                ghash.update(reinterpret_cast<const uint8_t*>(aad.data()), aad.size());
+                ghash.pad();
+                ghash.update(reinterpret_cast<const uint8_t*>(cipher.data()), cipher.size());
+
+                GHash::Bytes hash = ghash.finish(aad.size(), cipher.size());
+                check(name + (clmul ? " GHASH pclmul" : " GHASH table"), toHex(hash.data(), hash.size()) == gcmCase.hash);
+            }
+
+            GcmStream<4, rows, 10> encryptor(keySchedule, roundEngine, fromHex(gcmCase.iv), false);
+            std::string output(plain.size(), '\0');
+
+            encryptor.addAuthenticatedData(aad.data(), aad.size());
+            encryptor.update(plain.data(), plain.size(), output.data());
+            encryptor.finish(output.data());
+
+            const GcmStream<4, rows, 10>::Tag& tag = encryptor.getTag();
+            check(name + " encrypt", output == cipher && toHex(reinterpret_cast<const uint8_t*>(tag.data()), tag.size()) == gcmCase.tag);
+
+            auto decrypts = [&](const GcmStream<4, rows, 10>::Tag& expected) { // False when finish rejects the tag
+                GcmStream<4, rows, 10> decryptor(keySchedule, roundEngine, fromHex(gcmCase.iv), true);
+                std::string decrypted(cipher.size(), '\0');
+
+                decryptor.addAuthenticatedData(aad.data(), aad.size());
+                decryptor.setExpectedTag(expected);
+                decryptor.update(cipher.data(), cipher.size(), decrypted.data());
+
+                try {
+                    decryptor.finish(decrypted.data());
+                } catch (const std::runtime_error&) {
+                    return false;
+                }
+
+                return decrypted == plain;
+            };
+
+            GcmStream<4, rows, 10>::Tag forged = tag;
+            forged[0] ^= 1;
+
+            check(name + " decrypt", decrypts(tag) && !decrypts(forged));
+        }
+    }
+
+    void checkKeyDerivation() {
+        auto bytes = [](const std::string& text) { return reinterpret_cast<const uint8_t*>(text.data()); };
+        auto pbkdf2 = [&](const std::string& password, const std::string& salt, uint32_t iterations, size_t length) {
+            std::vector<uint8_t> key = Kdf::pbkdf2(password, bytes(salt), salt.size(), iterations, length);
+
+            return toHex(key.data(), key.size());
+        };
+        auto scrypt = [&](const std::string& password, const std::string& salt, unsigned logN, size_t r, size_t p) {
+            std::vector<uint8_t> key = Kdf::scrypt(password, bytes(salt), salt.size(), logN, r, p, 64);
+
+            return toHex(key.data(), key.size());
+        };
+
+        std::string abc = "abc";
+        std::string twoBlocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+        Sha256::Digest abcDigest = Sha256::hash(abc.data(), abc.size());
+        Sha256::Digest twoBlockDigest = Sha256::hash(twoBlocks.data(), twoBlocks.size());
+
+        check("SHA-256 FIPS 180-4 one block", toHex(abcDigest.data(), abcDigest.size()) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        check("SHA-256 FIPS 180-4 two blocks", toHex(twoBlockDigest.data(), twoBlockDigest.size()) == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+        check("PBKDF2-HMAC-SHA256 1 iteration", pbkdf2("password", "salt", 1, 32) == "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b");
+        check("PBKDF2-HMAC-SHA256 4096 iterations", pbkdf2("password", "salt", 4096, 32) == "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a");
+        check("PBKDF2-HMAC-SHA256 two output blocks", pbkdf2("passwordPASSWORDpassword", "saltSALTsaltSALTsaltSALTsaltSALTsalt", 4096, 40)
+            == "348c89dbcbd32b2f32d814b8116e84cf2b17347ebc1800181c4e2a1fb8dd53e1c635518c7dac47e9");
+
+        check("scrypt RFC 7914 N=16", scrypt("", "", 4, 1, 1)
+            == "77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906");
+        check("scrypt RFC 7914 N=1024", scrypt("password", "NaCl", 10, 8, 16)
+            == "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b3731622eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640");
+    }
+
+    void checkRandomStatistics() { // FIPS 140-2 monobit, poker, runs and long run tests on 20000 bits, a good generator fails one about once in a million runs
+        constexpr size_t bitCount = 20000;
+        std::string sample = SecureRandom::local().bytes(bitCount / 8);
+
+        auto bit = [&](size_t i) { return (static_cast<uint8_t>(sample[i / 8]) >> (7 - i % 8)) & 1; };
+
+        size_t ones = 0;
+        for (size_t i = 0; i < bitCount; i++) ones += bit(i);
+
+        check("Random monobit", ones > 9725 && ones < 10275);
+
+        std::array<size_t, 16> nibbles{};
+        for (char byte : sample) {
+            nibbles[static_cast<uint8_t>(byte) >> 4]++;
+            nibbles[static_cast<uint8_t>(byte) & 0xF]++;
+        }
+
+        double squares = 0;
+        for (size_t count : nibbles) squares += double(count) * count;
+
+        double poker = 16.0 / 5000 * squares - 5000;
+        check("Random poker", poker > 2.16 && poker < 46.17);
+
+        constexpr size_t runMin[6] = {2315, 1114, 527, 240, 103, 103};
+        constexpr size_t runMax[6] = {2685, 1386, 723, 384, 209, 209};
+        std::array<std::array<size_t, 6>, 2> runs{}; // By bit value, lengths 1 to 5 and 6 or more
+        size_t longest = 0;
+
+        for (size_t i = 0, length = 1; i < bitCount; i++, length++) {
+            if (i + 1 < bitCount && bit(i + 1) == bit(i)) continue;
+
+            runs[bit(i)][std::min<size_t>(length, 6) - 1]++;
+            longest = std::max(longest, length);
+            length = 0;
+        }
+
+        bool runsPassed = true;
+        for (const std::array<size_t, 6>& counts : runs) {
+            for (size_t n = 0; n < 6; n++) runsPassed &= counts[n] >= runMin[n] && counts[n] <= runMax[n];
+        }
+
+        check("Random runs", runsPassed);
+        check("Random long run", longest < 26);
+    }
+
+    void checkRandom() {
+        SecureRandom::Key seed;
+        for (size_t i = 0; i < seed.size(); i++) seed[i] = static_cast<char>(i);
+
+        SecureRandom seeded(seed); // Serves AES-256 of counters 2 onwards, the first two blocks become the next key
+        std::string output = seeded.bytes((SecureRandom::bufferBlocks - 2) * blockSize + blockSize);
+
+        Block<SecureRandom::Shape::keyWordCount, rows> key = Block<SecureRandom::Shape::keyWordCount, rows>::fromString(std::string(seed.begin(), seed.end()));
+        SecureRandom::Schedule keySchedule(key, subBox, SecureRandom::Shape::roundConstants);
+        bool matches = true;
+
+        for (size_t n : {size_t(2), size_t(3), SecureRandom::bufferBlocks - 1}) {
+            Block<cols, rows> counter;
+            counter[cols - 1][rows - 1] = static_cast<uint8_t>(n);
+            counter.encrypt(keySchedule, subBox, mixColMatrix);
+
+            matches &= std::memcmp(&counter, output.data() + (n - 2) * blockSize, blockSize) == 0;
+        }
+
+        check("Random generator counter keystream", matches);
+        check("Random generator rekeys every refill", output.substr(output.size() - blockSize) != SecureRandom(seed).bytes(blockSize));
+
+        checkRandomStatistics();
+
+        std::string first = SecureRandom::local().bytes(32);
+        check("Random draws differ", first != SecureRandom::local().bytes(32) && SecureRandom().bytes(32) != SecureRandom().bytes(32));
+
+#if FORK_HANDLERS
+        int pipeEnds[2];
+
+        if (pipe(pipeEnds) == 0) { // A forked child inherits the buffered state and must not repeat what the parent draws next
+            pid_t child = fork();
+
+            if (child == 0) {
+                std::string drawn = SecureRandom::local().bytes(32);
+                ssize_t written = write(pipeEnds[1], drawn.data(), drawn.size());
+
+                _exit(written == 32 ? 0 : 1);
+            }
+
+            std::string parent = SecureRandom::local().bytes(32);
+            std::string drawn(32, '\0');
+            ssize_t received = child > 0 ? read(pipeEnds[0], drawn.data(), drawn.size()) : -1;
+
+            if (child > 0) waitpid(child, nullptr, 0);
+
+            close(pipeEnds[0]);
+            close(pipeEnds[1]);
+
+            check("Random generator reseeds after fork", received == 32 && drawn != parent);
+        }
+#endif
+    }
+
+    static const char* backendName(EngineBackend backend) {
+        switch (backend) {
+            case EngineBackend::Table: return "table";
+            case EngineBackend::Bitsliced: return "bitsliced";
+            case EngineBackend::AesNi: return "aes-ni";
+            case EngineBackend::Vaes: return "vaes";
+            default: return "auto";
+        }
+    }
+
+public:
+    explicit SelfTest(std::ostream& stream) : stream(stream) {}
+
+    bool run() { // Returns true when every check passed
+        checkSubstitution();
+        checkKeyDerivation();
+        checkRandom();
+
+        if constexpr (cols == 4 && rows == 4) {
+            if (roundEngine.hasAESParameters()) {
+                checkKeyExpansion();
+                checkGcm();
+            }
+
+            checkCipher<4, 10>("AES-128 FIPS-197 C.1", "000102030405060708090a0b0c0d0e0f", "00112233445566778899aabbccddeeff", "69c4e0d86a7b0430d8cdb78070b4c55a");
+            checkCipher<6, 12>("AES-192 FIPS-197 C.2", "000102030405060708090a0b0c0d0e0f1011121314151617", "00112233445566778899aabbccddeeff", "dda97ca4864cdfe06eaf70a0ec0d7191");
+            checkCipher<8, 14>("AES-256 FIPS-197 C.3", "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f", "00112233445566778899aabbccddeeff", "8ea2b7ca516745bfeafc49904b496089");
+
+            checkWideBlock<6, 6>("Rijndael 192-bit block");
+            checkWideBlock<8, 8>("Rijndael 256-bit block");
+        }
+
+        stream << (failures == 0 ? "All self tests passed" : std::to_string(failures) + " self tests failed") << '\n';
+
+        return failures == 0;
+    }
+};
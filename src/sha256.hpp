@@ -0,0 +1,306 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "cpu_features.hpp"
+#include "util.hpp"
+
+// SHA-256 (FIPS 180-4). The compression function uses the SHA extensions when the CPU has them, otherwise plain integer code.
+// compressLanes runs eight independent single block compressions side by side in AVX2 registers, for callers with many
+// equal length messages in flight such as the separate output blocks of PBKDF2.
+class Sha256 {
+public:
+    static constexpr size_t blockSize = 64;
+    static constexpr size_t digestSize = 32;
+    static constexpr size_t laneCount = 8;
+
+    using State = std::array<uint32_t, 8>;
+    using Digest = std::array<uint8_t, digestSize>;
+    using LaneWords = uint32_t[16][laneCount]; // Word t of every lane's block, already read as big endian integers
+    using LaneState = uint32_t[8][laneCount];
+
+    static constexpr State initialState = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+private:
+    static constexpr std::array<uint32_t, 64> roundConstants = {
+        0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+        0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+        0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+        0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+        0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+        0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+        0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+        0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+    };
+
+    State state = initialState;
+    std::array<uint8_t, blockSize> buffer{};
+    size_t bufferLength = 0;
+    uint64_t totalLength = 0;
+
+    static constexpr uint32_t rotateRight(uint32_t value, int count) {
+        return (value >> count) | (value << (32 - count));
+    }
+
+    static void compressWords(State& state, uint32_t* w) { // w holds the 16 message words and is used as the rolling schedule
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (int t = 0; t < 64; t++) {
+            if (t >= 16) {
+                uint32_t w15 = w[(t - 15) & 15];
+                uint32_t w2 = w[(t - 2) & 15];
+
+                w[t & 15] += (rotateRight(w15, 7) ^ rotateRight(w15, 18) ^ (w15 >> 3)) + w[(t - 7) & 15] + (rotateRight(w2, 17) ^ rotateRight(w2, 19) ^ (w2 >> 10));
+            }
+
+            uint32_t t1 = h + (rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25)) + ((e & f) ^ (~e & g)) + roundConstants[t] + w[t & 15];
+            uint32_t t2 = (rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+
+    static void compressScalar(State& state, const uint8_t* blocks, size_t count) {
+        for (size_t b = 0; b < count; b++) {
+            uint32_t w[16];
+
+            for (int i = 0; i < 16; i++) {
+                w[i] = loadBigEndian(blocks + b * blockSize + i * 4);
+            }
+
+            compressWords(state, w);
+        }
+    }
+
+#if CPU_X86
+    CPU_TARGET("sha,sse4.1")
+    static void compressShaNi(State& state, const uint8_t* blocks, size_t count) {
+        const __m128i byteSwap = _mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+
+        __m128i swapped = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state.data())), 0xB1); // CDAB
+        __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state.data() + 4)), 0x1B); // EFGH
+        __m128i state0 = _mm_alignr_epi8(swapped, state1, 8); // ABEF, the register layout the round instruction expects
+        state1 = _mm_blend_epi16(state1, swapped, 0xF0); // CDGH
+
+        for (size_t b = 0; b < count; b++) {
+            const uint8_t* block = blocks + b * blockSize;
+            __m128i savedState0 = state0;
+            __m128i savedState1 = state1;
+            __m128i message[4];
+
+            #pragma GCC unroll 16
+            for (size_t g = 0; g < 16; g++) { // Four rounds per group, the schedule for group g + 1 is finished while group g runs
+                if (g < 4) message[g] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + g * 16)), byteSwap);
+
+                __m128i words = _mm_add_epi32(message[g % 4], _mm_loadu_si128(reinterpret_cast<const __m128i*>(roundConstants.data() + g * 4)));
+                state1 = _mm_sha256rnds2_epu32(state1, state0, words);
+
+                if (g >= 3 && g <= 14) {
+                    __m128i shifted = _mm_alignr_epi8(message[g % 4], message[(g + 3) % 4], 4);
+
+                    message[(g + 1) % 4] = _mm_sha256msg2_epu32(_mm_add_epi32(message[(g + 1) % 4], shifted), message[g % 4]);
+                }
+
+                state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(words, 0x0E));
+
+                if (g >= 1 && g <= 12) message[(g + 3) % 4] = _mm_sha256msg1_epu32(message[(g + 3) % 4], message[g % 4]);
+            }
+
+            state0 = _mm_add_epi32(state0, savedState0);
+            state1 = _mm_add_epi32(state1, savedState1);
+        }
+
+        swapped = _mm_shuffle_epi32(state0, 0x1B); // FEBA
+        state1 = _mm_shuffle_epi32(state1, 0xB1); // DCHG
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state.data()), _mm_blend_epi16(swapped, state1, 0xF0)); // DCBA
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state.data() + 4), _mm_alignr_epi8(state1, swapped, 8)); // HGFE
+    }
+
+    CPU_TARGET("avx2")
+    static __m256i rotateRightLanes(__m256i value, int count) {
+        return _mm256_or_si256(_mm256_srli_epi32(value, count), _mm256_slli_epi32(value, 32 - count));
+    }
+
+    CPU_TARGET("avx2")
+    static void compressLanesAVX2(LaneState& laneState, const LaneWords& message) {
+        __m256i w[16];
+        __m256i s[8];
+
+        for (int i = 0; i < 16; i++) w[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(message[i]));
+        for (int i = 0; i < 8; i++) s[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(laneState[i]));
+
+        __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+
+        for (int t = 0; t < 64; t++) {
+            if (t >= 16) {
+                __m256i w15 = w[(t - 15) & 15];
+                __m256i w2 = w[(t - 2) & 15];
+                __m256i sigma0 = _mm256_xor_si256(_mm256_xor_si256(rotateRightLanes(w15, 7), rotateRightLanes(w15, 18)), _mm256_srli_epi32(w15, 3));
+                __m256i sigma1 = _mm256_xor_si256(_mm256_xor_si256(rotateRightLanes(w2, 17), rotateRightLanes(w2, 19)), _mm256_srli_epi32(w2, 10));
+
+                w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], sigma0), _mm256_add_epi32(w[(t - 7) & 15], sigma1));
+            }
+
+            __m256i sum1 = _mm256_xor_si256(_mm256_xor_si256(rotateRightLanes(e, 6), rotateRightLanes(e, 11)), rotateRightLanes(e, 25));
+            __m256i choose = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sum1), _mm256_add_epi32(choose, _mm256_add_epi32(_mm256_set1_epi32(roundConstants[t]), w[t & 15])));
+
+            __m256i sum0 = _mm256_xor_si256(_mm256_xor_si256(rotateRightLanes(a, 2), rotateRightLanes(a, 13)), rotateRightLanes(a, 22));
+            __m256i majority = _mm256_xor_si256(_mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(a, c)), _mm256_and_si256(b, c));
+            __m256i t2 = _mm256_add_epi32(sum0, majority);
+
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(t1, t2);
+        }
+
+        __m256i result[8] = {a, b, c, d, e, f, g, h};
+
+        for (int i = 0; i < 8; i++) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(laneState[i]), _mm256_add_epi32(s[i], result[i]));
+        }
+    }
+#endif
+
+public:
+    static uint32_t loadBigEndian(const uint8_t* bytes) {
+        return static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16 | static_cast<uint32_t>(bytes[2]) << 8 | bytes[3];
+    }
+
+    static void storeBigEndian(uint8_t* bytes, uint32_t value) {
+        bytes[0] = static_cast<uint8_t>(value >> 24);
+        bytes[1] = static_cast<uint8_t>(value >> 16);
+        bytes[2] = static_cast<uint8_t>(value >> 8);
+        bytes[3] = static_cast<uint8_t>(value);
+    }
+
+    static bool hasHardwareSupport() {
+        return CpuFeatures::get().hasSHA() && CpuFeatures::get().hasSSE41();
+    }
+
+    static bool hasLaneSupport() {
+        return CpuFeatures::get().hasAVX2();
+    }
+
+    static void compress(State& state, const uint8_t* blocks, size_t count) {
+#if CPU_X86
+        if (hasHardwareSupport()) {
+            compressShaNi(state, blocks, count);
+
+            return;
+        }
+#endif
+        compressScalar(state, blocks, count);
+    }
+
+    static void compressLanes(LaneState& laneState, const LaneWords& message) { // One block for each of the eight lanes
+#if CPU_X86
+        if (hasLaneSupport()) {
+            compressLanesAVX2(laneState, message);
+
+            return;
+        }
+#endif
+        for (size_t lane = 0; lane < laneCount; lane++) {
+            State state;
+            uint32_t w[16];
+
+            for (int i = 0; i < 8; i++) state[i] = laneState[i][lane];
+            for (int i = 0; i < 16; i++) w[i] = message[i][lane];
+
+            compressWords(state, w);
+
+            for (int i = 0; i < 8; i++) laneState[i][lane] = state[i];
+        }
+    }
+
+    static Digest digestFromState(const State& state) {
+        Digest digest;
+
+        for (int i = 0; i < 8; i++) {
+            storeBigEndian(digest.data() + i * 4, state[i]);
+        }
+
+        return digest;
+    }
+
+    Sha256() = default;
+
+    explicit Sha256(const State& midState, uint64_t lengthSoFar) : state(midState), totalLength(lengthSoFar) {} // Resumes after whole blocks, as HMAC does from its padded keys
+
+    void update(const void* data, size_t length) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        totalLength += length;
+
+        if (bufferLength > 0) {
+            size_t taken = std::min(blockSize - bufferLength, length);
+
+            std::memcpy(buffer.data() + bufferLength, bytes, taken);
+            bufferLength += taken;
+            bytes += taken;
+            length -= taken;
+
+            if (bufferLength < blockSize) return;
+
+            compress(state, buffer.data(), 1);
+            bufferLength = 0;
+        }
+
+        size_t count = length / blockSize;
+        compress(state, bytes, count);
+
+        bufferLength = length - count * blockSize;
+        std::memcpy(buffer.data(), bytes + count * blockSize, bufferLength);
+    }
+
+    void update(const std::string& data) {
+        update(data.data(), data.size());
+    }
+
+    Digest finish() {
+        uint64_t bitLength = totalLength * 8;
+        uint8_t padding[blockSize * 2] = {0x80};
+        size_t paddingLength = (bufferLength < 56 ? 56 : 120) - bufferLength;
+
+        for (int i = 0; i < 8; i++) {
+            padding[paddingLength + i] = static_cast<uint8_t>(bitLength >> (56 - i * 8));
+        }
+
+        update(padding, paddingLength + 8);
+
+        return digestFromState(state);
+    }
+
+    static Digest hash(const void* data, size_t length) {
+        Sha256 sha;
+        sha.update(data, length);
+
+        return sha.finish();
+    }
+};
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <bit>
+#include <algorithm>
+#include <cstdint>
+
+#include "cpu_features.hpp"
+
+inline uint64_t readCycles() { // TSC ticks, which run at the base clock rather than the current core clock
+#if CPU_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Where the time of processing a file goes. File covers a whole processFile call, the rest are its parts
+enum class Stage : uint8_t {
+    File,
+    KeyDerivation,
+    Header,
+    Read,
+    Cipher,
+    Write,
+    Commit
+};
+
+constexpr size_t stageCount = 7;
+
+inline const char* stageName(Stage stage) {
+    static constexpr const char* names[stageCount] = {"file", "key_derivation", "header", "read", "cipher", "write", "commit"};
+
+    return names[static_cast<size_t>(stage)];
+}
+
+// Process wide counters per stage, collected only after enable() so a run without --stats pays a single predictable branch per timer.
+// Everything is a relaxed atomic add, timers sit around whole chunks (a megabyte) rather than blocks, which keeps the cost far below 1%
+class Stats {
+public:
+    static constexpr size_t bucketCount = 20; // Latency histogram, bucket b counts times up to 4^b microseconds, the last one everything above
+
+private:
+    struct StageCounters {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> nanoseconds{0};
+        std::atomic<uint64_t> maxNanoseconds{0};
+        std::atomic<uint64_t> cycles{0};
+        std::atomic<uint64_t> bytes{0};
+        std::array<std::atomic<uint64_t>, bucketCount> buckets{};
+    };
+
+    std::atomic<bool> enabled{false};
+    std::array<StageCounters, stageCount> stages;
+    std::atomic<uint64_t> failedFiles{0};
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    static size_t bucketFor(uint64_t nanoseconds) {
+        uint64_t microseconds = (nanoseconds + 999) / 1000;
+
+        if (microseconds <= 1) return 0;
+
+        return std::min<size_t>((std::bit_width(microseconds - 1) + 1) / 2, bucketCount - 1); // Smallest b with 4^b >= microseconds
+    }
+
+    static double bucketBound(size_t bucket) { // Seconds
+        return static_cast<double>(uint64_t(1) << (2 * bucket)) / 1e6;
+    }
+
+    double quantile(const StageCounters& counters, double q) const { // Upper bound of the bucket holding the q quantile
+        uint64_t total = counters.count.load(std::memory_order_relaxed);
+        uint64_t seen = 0;
+
+        for (size_t b = 0; b < bucketCount; b++) {
+            seen += counters.buckets[b].load(std::memory_order_relaxed);
+
+            if (total > 0 && seen >= q * total) return std::min(bucketBound(b), counters.maxNanoseconds.load(std::memory_order_relaxed) / 1e9);
+        }
+
+        return counters.maxNanoseconds.load(std::memory_order_relaxed) / 1e9;
+    }
+
+public:
+    static Stats& global() {
+        static Stats stats;
+
+        return stats;
+    }
+
+    void enable() {
+        startTime = std::chrono::steady_clock::now();
+        enabled.store(true, std::memory_order_relaxed);
+    }
+
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    void record(Stage stage, uint64_t nanoseconds, uint64_t cycles, uint64_t bytes) {
+        StageCounters& counters = stages[static_cast<size_t>(stage)];
+
+        counters.count.fetch_add(1, std::memory_order_relaxed);
+        counters.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+        counters.cycles.fetch_add(cycles, std::memory_order_relaxed);
+        counters.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        counters.buckets[bucketFor(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t previous = counters.maxNanoseconds.load(std::memory_order_relaxed);
+        while (previous < nanoseconds && !counters.maxNanoseconds.compare_exchange_weak(previous, nanoseconds, std::memory_order_relaxed)) {}
+    }
+
+    void recordFailure() {
+        if (isEnabled()) failedFiles.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::string formatText() const {
+        std::ostringstream out;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        out << std::left << std::setw(16) << "stage" << std::right << std::setw(10) << "count" << std::setw(12) << "total s" << std::setw(12) << "mean ms"
+            << std::setw(12) << "p99 ms" << std::setw(12) << "max ms" << std::setw(14) << "MB" << std::setw(12) << "MB/s" << std::setw(10) << "c/B" << '\n';
+
+        for (size_t s = 0; s < stageCount; s++) {
+            const StageCounters& counters = stages[s];
+            uint64_t count = counters.count.load(std::memory_order_relaxed);
+
+            if (count == 0) continue;
+
+            double seconds = counters.nanoseconds.load(std::memory_order_relaxed) / 1e9;
+            uint64_t bytes = counters.bytes.load(std::memory_order_relaxed);
+
+            out << std::left << std::setw(16) << stageName(static_cast<Stage>(s)) << std::right << std::fixed << std::setw(10) << count
+                << std::setw(12) << std::setprecision(4) << seconds
+                << std::setw(12) << std::setprecision(3) << seconds * 1e3 / count
+                << std::setw(12) << std::setprecision(3) << quantile(counters, 0.99) * 1e3
+                << std::setw(12) << std::setprecision(3) << counters.maxNanoseconds.load(std::memory_order_relaxed) / 1e6
+                << std::setw(14) << std::setprecision(2) << bytes / 1e6
+                << std::setw(12) << std::setprecision(1) << (bytes > 0 && seconds > 0 ? bytes / seconds / 1e6 : 0)
+                << std::setw(10) << std::setprecision(2) << (bytes > 0 ? static_cast<double>(counters.cycles.load(std::memory_order_relaxed)) / bytes : 0) << '\n';
+        }
+
+        out << "failed files " << failedFiles.load(std::memory_order_relaxed) << ", wall time " << std::fixed << std::setprecision(4) << elapsed << " s\n";
+
+        return out.str();
+    }
+
+    std::string formatJson() const {
+        std::ostringstream out;
+
+        out << "{\n  \"wall_seconds\": " << std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count()
+            << ",\n  \"failed_files\": " << failedFiles.load(std::memory_order_relaxed) << ",\n  \"stages\": {";
+
+        for (size_t s = 0; s < stageCount; s++) {
+            const StageCounters& counters = stages[s];
+
+            out << (s == 0 ? "\n" : ",\n") << "    \"" << stageName(static_cast<Stage>(s)) << "\": {"
+                << "\"count\": " << counters.count.load(std::memory_order_relaxed)
+                << ", \"seconds\": " << counters.nanoseconds.load(std::memory_order_relaxed) / 1e9
+                << ", \"max_seconds\": " << counters.maxNanoseconds.load(std::memory_order_relaxed) / 1e9
+                << ", \"p50_seconds\": " << quantile(counters, 0.5)
+                << ", \"p99_seconds\": " << quantile(counters, 0.99)
+                << ", \"bytes\": " << counters.bytes.load(std::memory_order_relaxed)
+                << ", \"tsc_cycles\": " << counters.cycles.load(std::memory_order_relaxed) << "}";
+        }
+
+        out << "\n  }\n}\n";
+
+        return out.str();
+    }
+
+    std::string formatPrometheus() const { // Text exposition format, for node_exporter's textfile collector
+        std::ostringstream out;
+
+        out << "# HELP diye_stage_seconds Time spent per processing stage.\n# TYPE diye_stage_seconds histogram\n";
+
+        for (size_t s = 0; s < stageCount; s++) {
+            const StageCounters& counters = stages[s];
+            std::string label = std::string("stage=\"") + stageName(static_cast<Stage>(s)) + "\"";
+            uint64_t cumulative = 0;
+
+            for (size_t b = 0; b + 1 < bucketCount; b++) {
+                cumulative += counters.buckets[b].load(std::memory_order_relaxed);
+                out << "diye_stage_seconds_bucket{" << label << ",le=\"" << bucketBound(b) << "\"} " << cumulative << '\n';
+            }
+
+            out << "diye_stage_seconds_bucket{" << label << ",le=\"+Inf\"} " << counters.count.load(std::memory_order_relaxed) << '\n'
+                << "diye_stage_seconds_sum{" << label << "} " << counters.nanoseconds.load(std::memory_order_relaxed) / 1e9 << '\n'
+                << "diye_stage_seconds_count{" << label << "} " << counters.count.load(std::memory_order_relaxed) << '\n';
+        }
+
+        out << "# HELP diye_stage_bytes_total Bytes passed through each stage.\n# TYPE diye_stage_bytes_total counter\n";
+
+        for (size_t s = 0; s < stageCount; s++) {
+            out << "diye_stage_bytes_total{stage=\"" << stageName(static_cast<Stage>(s)) << "\"} " << stages[s].bytes.load(std::memory_order_relaxed) << '\n';
+        }
+
+        out << "# HELP diye_stage_tsc_cycles_total TSC ticks spent per stage.\n# TYPE diye_stage_tsc_cycles_total counter\n";
+
+        for (size_t s = 0; s < stageCount; s++) {
+            out << "diye_stage_tsc_cycles_total{stage=\"" << stageName(static_cast<Stage>(s)) << "\"} " << stages[s].cycles.load(std::memory_order_relaxed) << '\n';
+        }
+
+        out << "# HELP diye_failed_files_total Files that could not be processed.\n# TYPE diye_failed_files_total counter\n"
+            << "diye_failed_files_total " << failedFiles.load(std::memory_order_relaxed) << '\n';
+
+        return out.str();
+    }
+};
+
+// Times its scope into one stage of Stats::global(), bytes can be added as they become known
+class StageTimer {
+    Stage stage;
+    bool active;
+    uint64_t bytes;
+    uint64_t startCycles = 0;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit StageTimer(Stage stage, uint64_t bytes = 0) : stage(stage), active(Stats::global().isEnabled()), bytes(bytes) {
+        if (!active) return;
+
+        start = std::chrono::steady_clock::now();
+        startCycles = readCycles();
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    ~StageTimer() {
+        stop();
+    }
+
+    void addBytes(uint64_t count) {
+        bytes += count;
+    }
+
+    void stop() { // Records now instead of at the end of the scope
+        if (!active) return;
+
+        active = false;
+
+        uint64_t cycles = readCycles() - startCycles;
+        uint64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        Stats::global().record(stage, nanoseconds, cycles, bytes);
+    }
+};
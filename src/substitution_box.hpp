@@ -3,8 +3,12 @@
 #include <array>
 #include <string>
 #include <ostream>
+#include <algorithm>
 
 #include "gf256.hpp"
+#include "cpu_features.hpp"
+
+static_assert(sizeof(GF256) == 1, "S-box rows are loaded straight into vector registers");
 
 class SubstitutionBox {
     std::array<GF256, 256> map;
@@ -32,6 +36,83 @@ class SubstitutionBox {
         return result ^ constantVector;
     }
 
+#if CPU_X86
+    // Nibble split lookup: the 256 entries are 16 rows of 16, each row is a PSHUFB table indexed by the low nibble
+    // and the row matching the high nibble is kept by a compare mask. All 16 rows are read for every byte.
+    template <bool inverse>
+    CPU_TARGET("ssse3")
+    __m128i substituteVector(__m128i input) const {
+        const GF256* table = inverse ? mapInv.data() : map.data();
+
+        __m128i nibbleMask = _mm_set1_epi8(0x0F);
+        __m128i low = _mm_and_si128(input, nibbleMask);
+        __m128i high = _mm_and_si128(_mm_srli_epi16(input, 4), nibbleMask);
+        __m128i result = _mm_setzero_si128();
+
+        for (int h = 0; h < 16; h++) {
+            __m128i row = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table + h * 16));
+            __m128i select = _mm_cmpeq_epi8(high, _mm_set1_epi8(h));
+
+            result = _mm_or_si128(result, _mm_and_si128(_mm_shuffle_epi8(row, low), select));
+        }
+
+        return result;
+    }
+
+    template <bool inverse>
+    CPU_TARGET("ssse3")
+    void substituteSSSE3(GF256* values, size_t count) const {
+        size_t i = 0;
+
+        for (; i + 16 <= count; i += 16) {
+            __m128i* address = reinterpret_cast<__m128i*>(values + i);
+
+            _mm_storeu_si128(address, substituteVector<inverse>(_mm_loadu_si128(address)));
+        }
+
+        if (i < count) { // The tail goes through a zero padded copy so it takes the same path as full vectors
+            alignas(16) GF256 tail[16] = {};
+
+            std::copy(values + i, values + count, tail);
+            _mm_store_si128(reinterpret_cast<__m128i*>(tail), substituteVector<inverse>(_mm_load_si128(reinterpret_cast<const __m128i*>(tail))));
+            std::copy(tail, tail + (count - i), values + i);
+        }
+    }
+
+    template <bool inverse>
+    CPU_TARGET("avx2")
+    void substituteAVX2(GF256* values, size_t count) const {
+        const GF256* table = inverse ? mapInv.data() : map.data();
+
+        __m256i rows[16];
+
+        for (int h = 0; h < 16; h++) {
+            rows[h] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table + h * 16)));
+        }
+
+        __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+        size_t i = 0;
+
+        for (; i + 32 <= count; i += 32) {
+            __m256i* address = reinterpret_cast<__m256i*>(values + i);
+            __m256i input = _mm256_loadu_si256(address);
+            __m256i low = _mm256_and_si256(input, nibbleMask);
+            __m256i high = _mm256_and_si256(_mm256_srli_epi16(input, 4), nibbleMask);
+            __m256i result = _mm256_setzero_si256();
+
+            for (int h = 0; h < 16; h++) {
+                __m256i select = _mm256_cmpeq_epi8(high, _mm256_set1_epi8(h));
+
+                result = _mm256_or_si256(result, _mm256_and_si256(_mm256_shuffle_epi8(rows[h], low), select));
+            }
+
+            _mm256_storeu_si256(address, result);
+        }
+
+        if (i < count) substituteSSSE3<inverse>(values + i, count - i);
+    }
+#endif
+
 public:
     constexpr SubstitutionBox() : map{}, mapInv{} {
         for (int i = 0; i < 256; i++) {
@@ -42,14 +123,35 @@ public:
         }
     }
 
-    GF256 sub(GF256 val) const {
+    constexpr GF256 sub(GF256 val) const {
         return map[val.get()];
     }
 
-    GF256 subInv(GF256 val) const {
+    constexpr GF256 subInv(GF256 val) const {
         return mapInv[val.get()];
     }
 
+    template <bool inverse>
+    constexpr GF256 apply(GF256 val) const { // Direction fixed at compile time, for kernels that must not branch per byte
+        if constexpr (inverse) return mapInv[val.get()];
+        else return map[val.get()];
+    }
+
+    template <bool inverse>
+    void substitute(GF256* values, size_t count) const { // Whole blocks at once, by shuffles where the CPU has them so no lookup address depends on the data
+#if CPU_X86
+        if (CpuFeatures::get().hasSSSE3()) {
+            if (CpuFeatures::get().hasAVX2() && count >= 32) substituteAVX2<inverse>(values, count);
+            else substituteSSSE3<inverse>(values, count);
+
+            return;
+        }
+#endif
+        for (size_t i = 0; i < count; i++) {
+            values[i] = apply<inverse>(values[i]);
+        }
+    }
+
     friend std::ostream& operator<<(std::ostream& stream, const SubstitutionBox& subBox) {
         for (int i = 0; i < 16; i++) {
             if (i > 0) stream << '\n';
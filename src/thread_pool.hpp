@@ -0,0 +1,122 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <algorithm>
+
+// Fixed set of workers kept alive between calls, starting threads per chunk would cost more than decrypting a small chunk
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+                if (stopping && tasks.empty()) return;
+
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+
+            task();
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t threadCount) { // The thread calling parallelFor also does a share of the work, so threadCount - 1 workers are started
+        for (size_t i = 1; i < threadCount; i++) {
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        condition.notify_all();
+
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    static size_t defaultThreadCount() {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    size_t size() const {
+        return workers.size() + 1;
+    }
+
+    template <typename Function>
+    std::future<void> submit(Function&& function) {
+        auto task = std::make_shared<std::packaged_task<void()>>(std::forward<Function>(function));
+        std::future<void> result = task->get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace([task]() { (*task)(); });
+        }
+
+        condition.notify_one();
+
+        return result;
+    }
+
+    template <typename Function>
+    void parallelFor(size_t count, Function&& body) { // Calls body(begin, end) over contiguous ranges covering [0, count), one per thread, and rethrows the first failure
+        size_t rangeCount = std::min(size(), count);
+
+        if (rangeCount <= 1) {
+            if (count > 0) body(size_t(0), count);
+
+            return;
+        }
+
+        std::vector<std::future<void>> results;
+        results.reserve(rangeCount - 1);
+
+        for (size_t r = 1; r < rangeCount; r++) {
+            size_t begin = count * r / rangeCount;
+            size_t end = count * (r + 1) / rangeCount;
+
+            results.push_back(submit([&body, begin, end]() { body(begin, end); }));
+        }
+
+        std::exception_ptr failure;
+
+        try {
+            body(size_t(0), count / rangeCount);
+        } catch (...) {
+            failure = std::current_exception();
+        }
+
+        for (std::future<void>& result : results) {
+            try {
+                result.get();
+            } catch (...) {
+                if (!failure) failure = std::current_exception();
+            }
+        }
+
+        if (failure) std::rethrow_exception(failure);
+    }
+};
@@ -1,5 +1,37 @@
 #pragma once
 
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <type_traits>
+
+#include "cpu_features.hpp"
+
 constexpr int mod(int a, int b) {
     return (a % b + b) % b;
-}
\ No newline at end of file
+}
+
+constexpr int rowShift(int cols, int row) { // Columns ShiftRows moves a row by, Rijndael's 8-column blocks move rows 2 and 3 one further
+    return cols == 8 && row >= 2 ? row + 1 : row;
+}
+
+inline void secureZero(void* data, size_t length) { // A memset the compiler can't drop as a dead store before the memory is freed
+    std::memset(data, 0, length);
+#if defined(__GNUC__)
+    __asm__ __volatile__("" : : "r"(data) : "memory");
+#endif
+}
+
+template <size_t count, typename Function>
+constexpr void unroll(Function&& function) { // Calls function(std::integral_constant<size_t, i>{}) for every i below count, expanded at compile time
+    [&]<size_t... i>(std::index_sequence<i...>) {
+        (function(std::integral_constant<size_t, i>{}), ...);
+    }(std::make_index_sequence<count>{});
+}
+
+CPU_CLONES
+inline void xorBytes(const char* a, const char* b, char* output, size_t length) { // output may alias a or b
+    for (size_t i = 0; i < length; i++) {
+        output[i] = a[i] ^ b[i];
+    }
+}
@@ -116,10 +116,16 @@ public:
         }
     }
     
-    void subWord(const SubstitutionBox& subBox, bool inverse = false) {
-        for (int i = 0; i < size; i++) {
-            values[i] = inverse ? subBox.sub(values[i]) : subBox.subInv(values[i]);
-        }
+    template <bool inverse>
+    constexpr void substitute(const SubstitutionBox& subBox) {
+        unroll<size>([&](auto i) {
+            values[i] = subBox.apply<inverse>(values[i]);
+        });
+    }
+
+    constexpr void subWord(const SubstitutionBox& subBox, bool inverse = false) { // Picks a kernel once, neither loops over a runtime direction
+        if (inverse) substitute<true>(subBox);
+        else substitute<false>(subBox);
     }
 
     void applyConstant(GF256 constant) {